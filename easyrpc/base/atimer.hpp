@@ -4,6 +4,7 @@
 #include <vector>
 #include <atomic>
 #include <functional>
+#include "io_backend.hpp"
 #include <boost/timer.hpp>
 #include <boost/asio.hpp>
 
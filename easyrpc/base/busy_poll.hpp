@@ -0,0 +1,56 @@
+#ifndef _BUSY_POLL_H
+#define _BUSY_POLL_H
+
+#include <chrono>
+#include <sys/socket.h>
+#include "io_backend.hpp"
+#include <boost/asio.hpp>
+
+namespace easyrpc
+{
+
+// spin_micro为0时与io_service::run()相同；否则先在poll()上自旋，连续spin_micro没有事件才阻塞等待，
+// 有事件后重新开始自旋，用独占的CPU换取线程被唤醒的时延.
+inline void run_busy_poll(boost::asio::io_service& ios, std::size_t spin_micro)
+{
+    if (spin_micro == 0)
+    {
+        ios.run();
+        return;
+    }
+
+    using clock_type = std::chrono::steady_clock;
+    auto spin = std::chrono::microseconds(spin_micro);
+    while (!ios.stopped())
+    {
+        auto deadline = clock_type::now() + spin;
+        while (clock_type::now() < deadline && !ios.stopped())
+        {
+            if (ios.poll() != 0)
+            {
+                deadline = clock_type::now() + spin;
+            }
+        }
+        ios.run_one();
+    }
+}
+
+// 在socket上设置SO_BUSY_POLL，读取时内核在网卡队列上自旋busy_poll_micro；
+// 超过net.core.busy_read需要CAP_NET_ADMIN，设置失败时保持原样.
+template<typename Socket>
+void set_busy_poll(Socket& socket, std::size_t busy_poll_micro)
+{
+#ifdef SO_BUSY_POLL
+    if (busy_poll_micro == 0)
+    {
+        return;
+    }
+
+    int value = static_cast<int>(busy_poll_micro);
+    setsockopt(socket.native_handle(), SOL_SOCKET, SO_BUSY_POLL, &value, sizeof(value));
+#endif
+}
+
+}
+
+#endif
@@ -0,0 +1,176 @@
+#ifndef _FAIR_QUEUE_H
+#define _FAIR_QUEUE_H
+
+#include <set>
+#include <deque>
+#include <tuple>
+#include <cstdint>
+#include <algorithm>
+#include <unordered_map>
+
+namespace easyrpc
+{
+
+// 按flow公平出队的队列(start-time fair queuing)：任务入队时获得开始标签max(虚拟时间, 该flow上一个任务的结束标签)，
+// 结束标签为开始标签加cost，每次取开始标签最小的任务，虚拟时间推进到它的开始标签；
+// 各flow按cost轮流出队，一个flow排再多的任务也只能占自己的份额，所有任务都属于同一个flow时就是先进先出；
+// 入队、出队都是O(log flow数)，与cost大小无关.
+template<typename T>
+class fair_queue
+{
+public:
+    using flow_id = std::uint64_t;
+
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    std::size_t size() const
+    {
+        return size_;
+    }
+
+    void push_back(T&& item, flow_id flow = 0, std::size_t cost = 1)
+    {
+        auto& f = flow_map_[flow];
+        std::uint64_t start = std::max(virtual_time_, f.last_finish);
+        f.last_finish = start + (cost == 0 ? 1 : cost);
+        f.items.push_back({ std::move(item), start, next_seq_++ });
+        ++size_;
+        if (f.items.size() == 1)
+        {
+            add_head(flow, f);
+        }
+    }
+
+    // 下一个按份额应当出队的任务.
+    T& front()
+    {
+        return flow_map_.find(std::get<2>(*schedule_.begin()))->second.items.front().item;
+    }
+
+    const T& front() const
+    {
+        return flow_map_.find(std::get<2>(*schedule_.begin()))->second.items.front().item;
+    }
+
+    // 所有flow中最早入队的任务，用于按排队时间判断过载和老化.
+    const T& oldest() const
+    {
+        return flow_map_.find(arrival_.begin()->second)->second.items.front().item;
+    }
+
+    void pop_front()
+    {
+        flow_id id = std::get<2>(*schedule_.begin());
+        virtual_time_ = std::get<0>(*schedule_.begin());
+        pop_head(id);
+    }
+
+    // 过载丢弃时调用：取出排队最多的flow中最早的任务，让占用最多的调用方先承担丢弃；被丢弃的任务不推进虚拟时间.
+    T take_from_largest()
+    {
+        auto largest = flow_map_.end();
+        for (auto iter = flow_map_.begin(); iter != flow_map_.end(); ++iter)
+        {
+            if (largest == flow_map_.end() || iter->second.items.size() > largest->second.items.size())
+            {
+                largest = iter;
+            }
+        }
+
+        T item = std::move(largest->second.items.front().item);
+        pop_head(largest->first);
+        return item;
+    }
+
+    void clear()
+    {
+        flow_map_.clear();
+        schedule_.clear();
+        arrival_.clear();
+        idle_flows_.clear();
+        virtual_time_ = 0;
+        size_ = 0;
+    }
+
+private:
+    struct entry
+    {
+        T item;
+        std::uint64_t start;
+        std::uint64_t seq;      // 入队顺序，开始标签相同时先入队的先出队
+    };
+
+    struct flow
+    {
+        std::deque<entry> items;
+        std::uint64_t last_finish = 0;
+    };
+
+    // 只有各flow的队首任务在schedule_和arrival_中.
+    void add_head(flow_id id, const flow& f)
+    {
+        const entry& head = f.items.front();
+        schedule_.emplace(head.start, head.seq, id);
+        arrival_.emplace(head.seq, id);
+    }
+
+    void pop_head(flow_id id)
+    {
+        auto iter = flow_map_.find(id);
+        flow& f = iter->second;
+        const entry& head = f.items.front();
+        schedule_.erase(std::make_tuple(head.start, head.seq, id));
+        arrival_.erase(std::make_pair(head.seq, id));
+        f.items.pop_front();
+        --size_;
+        if (!f.items.empty())
+        {
+            add_head(id, f);
+        }
+        else if (f.last_finish <= virtual_time_)
+        {
+            // 结束标签已经不会超过虚拟时间，删掉不影响之后的标签.
+            flow_map_.erase(iter);
+        }
+        else
+        {
+            idle_flows_.emplace_back(id);
+        }
+        reap_idle_flows();
+    }
+
+    // 排空的flow在虚拟时间追上它的结束标签之前保留，防止它清空后立即重新入队而多占份额；
+    // 保留的flow数不超过flow_map_的大小.
+    void reap_idle_flows()
+    {
+        while (!idle_flows_.empty())
+        {
+            auto iter = flow_map_.find(idle_flows_.front());
+            if (iter != flow_map_.end() && iter->second.items.empty())
+            {
+                if (iter->second.last_finish > virtual_time_ && idle_flows_.size() <= flow_map_.size())
+                {
+                    return;
+                }
+                flow_map_.erase(iter);
+            }
+            idle_flows_.pop_front();
+        }
+    }
+
+private:
+    std::unordered_map<flow_id, flow> flow_map_;
+    std::set<std::tuple<std::uint64_t, std::uint64_t, flow_id>> schedule_;     // (开始标签, 入队顺序, flow)
+    std::set<std::pair<std::uint64_t, flow_id>> arrival_;                       // (入队顺序, flow)
+    std::deque<flow_id> idle_flows_;
+    std::uint64_t virtual_time_ = 0;
+    std::uint64_t next_seq_ = 0;
+    std::size_t size_ = 0;
+};
+
+}
+
+#endif
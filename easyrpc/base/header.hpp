@@ -7,13 +7,38 @@ namespace easyrpc
 {
 
 constexpr const int max_buffer_len = 8 * 1024 * 1024;
-const int request_header_len = 12;
-const int response_header_len = 4;
+constexpr const int max_pending_write_len = 2 * max_buffer_len;
+const int request_header_len = 32;
+const int response_header_len = 12;
+const std::string unix_prefix = "unix:";
+const std::string shm_prefix = "shm:";
 
 enum class call_mode : unsigned int
 {
     raw,
-    non_raw
+    non_raw,
+    cancel          // 取消request_id对应的请求，没有protocol和body
+};
+
+// 服务端优先调度高优先级的请求，低优先级的请求排队越久越优先，不会被饿死.
+enum class priority : unsigned int
+{
+    unspecified,    // 使用服务端为该协议设置的默认优先级
+    high,
+    normal,
+    low
+};
+
+// 请求头中的优先级来自客户端，使用前需检查.
+inline bool is_valid_priority(priority prio)
+{
+    return static_cast<unsigned int>(prio) <= static_cast<unsigned int>(priority::low);
+}
+
+// request_header::flags的取值，可按位组合.
+enum request_flag : unsigned int
+{
+    flag_one_way = 1 << 0       // 服务端执行后不应答
 };
 
 struct request_header
@@ -21,11 +46,30 @@ struct request_header
     unsigned int protocol_len;
     unsigned int body_len;
     call_mode mode;
+    unsigned int budget_milli;      // 调用方剩余的时间预算，0表示不限
+    unsigned int request_id;        // 同一连接上的多个请求以此区分应答
+    priority prio;
+    unsigned int flags;
+    unsigned int trace_id;          // 开启tracer时由客户端生成，0表示不跟踪
+};
+
+enum class rpc_status : unsigned int
+{
+    ok,
+    overloaded,
+    not_bound,
+    invalid_call_mode,
+    decode_error,
+    handler_error,
+    deadline_exceeded,
+    cancelled
 };
 
 struct response_header
 {
     unsigned int body_len;
+    rpc_status status;
+    unsigned int request_id;
 };
 
 using one_way = void;
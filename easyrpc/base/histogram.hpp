@@ -0,0 +1,208 @@
+#ifndef _HISTOGRAM_H
+#define _HISTOGRAM_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <initializer_list>
+
+namespace easyrpc
+{
+
+// 无锁的对数分桶直方图，每个2的幂区间再均分8个桶，相对误差不超过12.5%，
+// 多个线程可以同时record，percentile读到的是近似值.
+class histogram
+{
+public:
+    histogram()
+    {
+        reset();
+    }
+
+    histogram(const histogram&) = delete;
+    histogram& operator=(const histogram&) = delete;
+
+    void record(std::uint64_t value)
+    {
+        buckets_[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    std::uint64_t count() const
+    {
+        return count_.load(std::memory_order_relaxed);
+    }
+
+    std::uint64_t sum() const
+    {
+        return sum_.load(std::memory_order_relaxed);
+    }
+
+    // percentile取值(0, 1]，返回所在桶的上界，没有样本时返回0.
+    std::uint64_t percentile(double percentile) const
+    {
+        return merged_percentile(percentile, { this });
+    }
+
+    // 把几个直方图当作一个计算分位数.
+    static std::uint64_t merged_percentile(double percentile, std::initializer_list<const histogram*> parts)
+    {
+        std::uint64_t total = 0;
+        for (auto part : parts)
+        {
+            total += part->count();
+        }
+
+        if (total == 0)
+        {
+            return 0;
+        }
+
+        std::uint64_t rank = static_cast<std::uint64_t>(percentile * total);
+        rank = rank == 0 ? 1 : rank;
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < bucket_count; ++i)
+        {
+            for (auto part : parts)
+            {
+                seen += part->buckets_[i].load(std::memory_order_relaxed);
+            }
+
+            if (seen >= rank)
+            {
+                return bucket_upper_bound(i);
+            }
+        }
+        return bucket_upper_bound(bucket_count - 1);
+    }
+
+    void reset()
+    {
+        for (auto& bucket : buckets_)
+        {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        count_.store(0, std::memory_order_relaxed);
+        sum_.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    // 小于8的值各占一个桶，之后每个2的幂区间8个桶.
+    static std::size_t bucket_index(std::uint64_t value)
+    {
+        if (value < sub_bucket_count)
+        {
+            return static_cast<std::size_t>(value);
+        }
+
+        std::size_t exponent = log2(value);
+        std::size_t sub = static_cast<std::size_t>((value >> (exponent - sub_bucket_bits)) & (sub_bucket_count - 1));
+        std::size_t index = (exponent - sub_bucket_bits + 1) * sub_bucket_count + sub;
+        return index < bucket_count ? index : bucket_count - 1;
+    }
+
+    static std::size_t log2(std::uint64_t value)
+    {
+#if defined(__GNUC__)
+        return 63 - static_cast<std::size_t>(__builtin_clzll(value));
+#else
+        std::size_t exponent = 0;
+        while (value >>= 1)
+        {
+            ++exponent;
+        }
+        return exponent;
+#endif
+    }
+
+    static std::uint64_t bucket_upper_bound(std::size_t index)
+    {
+        if (index < sub_bucket_count)
+        {
+            return index;
+        }
+
+        std::size_t exponent = index / sub_bucket_count + sub_bucket_bits - 1;
+        std::uint64_t sub = index % sub_bucket_count;
+        return ((sub_bucket_count + sub + 1) << (exponent - sub_bucket_bits)) - 1;
+    }
+
+private:
+    static const std::size_t sub_bucket_bits = 3;
+    static const std::size_t sub_bucket_count = 1 << sub_bucket_bits;
+    static const std::size_t bucket_count = (64 - sub_bucket_bits + 1) * sub_bucket_count;
+    std::atomic<std::uint64_t> buckets_[bucket_count];
+    std::atomic<std::uint64_t> count_;
+    std::atomic<std::uint64_t> sum_;
+};
+
+static const std::size_t default_histogram_window_milli = 10000;
+
+// 只反映最近一段时间的直方图：样本记在当前窗口，每过window_milli丢弃上上个窗口，
+// 分位数按最近两个窗口(window_milli到2 * window_milli之间)计算；切换窗口时并发记录的个别样本可能丢失.
+class windowed_histogram
+{
+public:
+    using clock_type = std::chrono::steady_clock;
+
+    explicit windowed_histogram(std::size_t window_milli = default_histogram_window_milli) 
+        : window_(std::chrono::milliseconds(window_milli == 0 ? 1 : window_milli)),
+          window_start_(clock_type::now().time_since_epoch().count()) {}
+
+    windowed_histogram(const windowed_histogram&) = delete;
+    windowed_histogram& operator=(const windowed_histogram&) = delete;
+
+    void record(std::uint64_t value)
+    {
+        rotate();
+        slots_[current_.load(std::memory_order_acquire)].record(value);
+    }
+
+    std::uint64_t count() const
+    {
+        return slots_[0].count() + slots_[1].count();
+    }
+
+    std::uint64_t percentile(double percentile) const
+    {
+        return histogram::merged_percentile(percentile, { &slots_[0], &slots_[1] });
+    }
+
+    void reset()
+    {
+        slots_[0].reset();
+        slots_[1].reset();
+    }
+
+private:
+    void rotate()
+    {
+        clock_type::rep now = clock_type::now().time_since_epoch().count();
+        clock_type::rep start = window_start_.load(std::memory_order_relaxed);
+        if (now - start < window_.count() || !window_start_.compare_exchange_strong(start, now))
+        {
+            return;
+        }
+
+        // 很久没有样本时两个窗口都已过期.
+        std::size_t next = 1 - current_.load(std::memory_order_relaxed);
+        slots_[next].reset();
+        if (now - start >= 2 * window_.count())
+        {
+            slots_[1 - next].reset();
+        }
+        current_.store(next, std::memory_order_release);
+    }
+
+private:
+    clock_type::duration window_;
+    std::atomic<clock_type::rep> window_start_;
+    std::atomic<std::size_t> current_{ 0 };
+    histogram slots_[2];
+};
+
+}
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef _IO_BACKEND_H
+#define _IO_BACKEND_H
+
+// 编译时定义EASYRPC_ENABLE_IO_URING并链接liburing，Linux上socket的accept和读写改由boost::asio的
+// io_uring后端完成，接口和行为与默认的epoll后端一致；需要boost 1.78以上，并在boost/asio.hpp之前包含.
+#if defined(EASYRPC_ENABLE_IO_URING) && defined(__linux__)
+
+#include <boost/version.hpp>
+
+#if BOOST_VERSION < 107800
+#error "EASYRPC_ENABLE_IO_URING requires boost 1.78 or later"
+#endif
+
+#if defined(BOOST_ASIO_HPP) && !defined(BOOST_ASIO_HAS_IO_URING)
+#error "Include easyrpc before boost/asio.hpp, or define BOOST_ASIO_HAS_IO_URING and BOOST_ASIO_DISABLE_EPOLL globally"
+#endif
+
+#ifndef BOOST_ASIO_HAS_IO_URING
+#define BOOST_ASIO_HAS_IO_URING
+#endif
+
+// 只定义BOOST_ASIO_HAS_IO_URING时io_uring只用于文件读写，socket仍走epoll.
+#ifndef BOOST_ASIO_DISABLE_EPOLL
+#define BOOST_ASIO_DISABLE_EPOLL
+#endif
+
+#define EASYRPC_HAS_IO_URING
+
+#endif
+
+namespace easyrpc
+{
+
+inline const char* io_backend_name()
+{
+#ifdef EASYRPC_HAS_IO_URING
+    return "io_uring";
+#else
+    return "epoll";
+#endif
+}
+
+}
+
+#endif
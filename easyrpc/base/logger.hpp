@@ -2,15 +2,109 @@
 #define _LOGGER_H
 
 #include <iostream>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <spdlog/spdlog.h>
 #include "file_util.hpp"
 
+// 编译期的最低日志级别，低于它的log_xxx展开后不求值参数，由编译器整个去掉.
+#define EASYRPC_LOG_LEVEL_TRACE     0
+#define EASYRPC_LOG_LEVEL_DEBUG     1
+#define EASYRPC_LOG_LEVEL_INFO      2
+#define EASYRPC_LOG_LEVEL_WARN      3
+#define EASYRPC_LOG_LEVEL_ERROR     4
+#define EASYRPC_LOG_LEVEL_CRITICAL  5
+#define EASYRPC_LOG_LEVEL_OFF       6
+
+#ifndef EASYRPC_LOG_LEVEL
+#define EASYRPC_LOG_LEVEL EASYRPC_LOG_LEVEL_DEBUG
+#endif
+
 namespace easyrpc
 {
 
 static const std::string logger_name = "easyrpc";
 static const std::size_t max_file_size = 3 * 1024 * 1024;
 static const std::size_t max_files = 30;
+static const std::size_t default_log_queue_size = 8192;
+static const std::size_t default_log_max_per_second = 100;
+static const std::size_t default_log_sample_every = 1000;
+
+// 日志写出方式和限流参数，需在第一条日志之前设置.
+struct log_options
+{
+    std::size_t async_queue_size = 0;                               // 为0时同步写出
+    std::atomic<std::size_t> max_per_second{ default_log_max_per_second };  // 每个调用点每秒最多写出的条数，为0时不限
+    std::atomic<std::size_t> sample_every{ default_log_sample_every };     // 超出后每多少条抽样写出一条，为0时全部丢弃
+
+    static log_options& instance()
+    {
+        static log_options options;
+        return options;
+    }
+};
+
+// 日志交给spdlog的后台线程写出，队列是有界的无锁队列，满了丢弃新日志，不阻塞io线程和worker；
+// queue_size须为2的幂.
+inline void set_async_log(std::size_t queue_size = default_log_queue_size)
+{
+    log_options::instance().async_queue_size = queue_size;
+}
+
+// 同一个调用点每秒最多写出max_per_second条，超出部分每sample_every条抽样写出一条，
+// 写出时带上此前被丢弃的条数.
+inline void set_log_limit(std::size_t max_per_second, std::size_t sample_every)
+{
+    log_options::instance().max_per_second = max_per_second;
+    log_options::instance().sample_every = sample_every;
+}
+
+// 每个log_xxx调用点一个，按秒计数，多个线程同时写日志时不加锁.
+class log_limiter
+{
+public:
+    using clock_type = std::chrono::steady_clock;
+
+    // 返回false表示本条被丢弃；返回true时suppressed为此前被丢弃的条数.
+    bool allow(std::uint64_t& suppressed)
+    {
+        std::size_t max_per_second = log_options::instance().max_per_second.load(std::memory_order_relaxed);
+        if (max_per_second == 0)
+        {
+            return true;
+        }
+
+        std::int64_t now = std::chrono::duration_cast<std::chrono::seconds>(clock_type::now().time_since_epoch()).count();
+        std::int64_t window = window_.load(std::memory_order_relaxed);
+        if (now != window && window_.compare_exchange_strong(window, now))
+        {
+            count_.store(0, std::memory_order_relaxed);
+        }
+
+        std::uint64_t count = count_.fetch_add(1, std::memory_order_relaxed) + 1;
+        std::size_t sample_every = log_options::instance().sample_every.load(std::memory_order_relaxed);
+        if (count <= max_per_second || (sample_every != 0 && (count - max_per_second) % sample_every == 0))
+        {
+            suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+            return true;
+        }
+
+        suppressed_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+private:
+    std::atomic<std::int64_t> window_{ 0 };
+    std::atomic<std::uint64_t> count_{ 0 };
+    std::atomic<std::uint64_t> suppressed_{ 0 };
+};
+
+template<int Level>
+constexpr bool log_enabled()
+{
+    return Level >= EASYRPC_LOG_LEVEL;
+}
 
 class logger_impl
 {
@@ -84,6 +178,11 @@ private:
     {
         try
         {
+            std::size_t queue_size = log_options::instance().async_queue_size;
+            if (queue_size != 0)
+            {
+                spdlog::set_async_mode(queue_size, spdlog::async_overflow_policy::discard_log_msg);
+            }
             _console_logger = spdlog::stdout_logger_mt("console", false);
             _file_logger = spdlog::rotating_logger_mt("file", file_name, max_file_size, max_files);
             _console_logger->set_level(spdlog::level::debug); 
@@ -108,21 +207,34 @@ public:
     logger() = default;
     logger(const logger&) = delete;
     logger& operator=(const logger&) = delete;
-    logger(const char* file_path, const char* func_name, unsigned long line, spdlog::level::level_enum level)
-        : file_path_(file_path), file_name_(func_name), line_(line), level_(level) {}
+    logger(const char* file_path, const char* func_name, unsigned long line, spdlog::level::level_enum level, 
+           log_limiter* limiter = nullptr)
+        : file_path_(file_path), file_name_(func_name), line_(line), level_(level), limiter_(limiter) {}
 
+    // 返回值只用于log_xxx宏中的短路求值，被限流丢弃时返回false.
     template<typename... Args>
-    void log(const std::string& fmt, Args&&... args)
+    bool log(const std::string& fmt, Args&&... args)
     {
-        log(fmt.c_str(), std::forward<Args>(args)...);
+        return log(fmt.c_str(), std::forward<Args>(args)...);
     }
 
     template<typename... Args>
-    void log(const char* fmt, Args&&... args)
+    bool log(const char* fmt, Args&&... args)
     {
-        const std::string& content = make_content(fmt);
+        std::uint64_t suppressed = 0;
+        if (limiter_ != nullptr && !limiter_->allow(suppressed))
+        {
+            return false;
+        }
+
+        std::string content = make_content(fmt);
+        if (suppressed != 0)
+        {
+            content = "(" + std::to_string(suppressed) + " suppressed) " + content;
+        }
         logger_impl::instance().get_console_logger()->log(level_, content.c_str(), std::forward<Args>(args)...);
         logger_impl::instance().get_file_logger()->log(level_, content.c_str(), std::forward<Args>(args)...);
+        return true;
     }
 
 private:
@@ -142,15 +254,20 @@ private:
     std::string file_name_;
     unsigned long line_;
     spdlog::level::level_enum level_;
+    log_limiter* limiter_ = nullptr;
 };
 
+// lambda表达式在每个调用点是不同的类型，其中的静态变量就是该调用点独有的限流器.
 #define LOCATION       __FILE__, __FUNCTION__, __LINE__
-#define log_trace       logger(LOCATION, spdlog::level::level_enum::trace).log
-#define log_debug       logger(LOCATION, spdlog::level::level_enum::debug).log
-#define log_info        logger(LOCATION, spdlog::level::level_enum::info).log
-#define log_warn        logger(LOCATION, spdlog::level::level_enum::warn).log
-#define log_error       logger(LOCATION, spdlog::level::level_enum::err).log
-#define log_critical    logger(LOCATION, spdlog::level::level_enum::critical).log
+#define LOG_SITE       []{ static ::easyrpc::log_limiter limiter; return &limiter; }()
+#define LOG_IMPL(lvl, min_level) \
+    log_enabled<min_level>() && ::easyrpc::logger(LOCATION, spdlog::level::level_enum::lvl, LOG_SITE).log
+#define log_trace       LOG_IMPL(trace, EASYRPC_LOG_LEVEL_TRACE)
+#define log_debug       LOG_IMPL(debug, EASYRPC_LOG_LEVEL_DEBUG)
+#define log_info        LOG_IMPL(info, EASYRPC_LOG_LEVEL_INFO)
+#define log_warn        LOG_IMPL(warn, EASYRPC_LOG_LEVEL_WARN)
+#define log_error       LOG_IMPL(err, EASYRPC_LOG_LEVEL_ERROR)
+#define log_critical    LOG_IMPL(critical, EASYRPC_LOG_LEVEL_CRITICAL)
 
 }
 
@@ -0,0 +1,57 @@
+#ifndef _PER_CORE_H
+#define _PER_CORE_H
+
+#include <memory>
+#include <atomic>
+#include <functional>
+#include <unordered_map>
+
+namespace easyrpc
+{
+
+// 每个线程持有一份由factory创建的对象，在该线程第一次访问时创建，
+// thread-per-core模式下io线程绑定了CPU，也就是每个核一份，互不共享.
+template<typename T>
+class per_core
+{
+public:
+    using factory_t = std::function<std::shared_ptr<T>()>;
+    per_core(const per_core&) = delete;
+    per_core& operator=(const per_core&) = delete;
+    explicit per_core(const factory_t& factory) : factory_(factory), id_(next_id()) {}
+
+    T* get()
+    {
+        auto& instances = thread_instances();
+        auto iter = instances.find(id_);
+        if (iter != instances.end())
+        {
+            return static_cast<T*>(iter->second.get());
+        }
+
+        std::shared_ptr<T> instance = factory_();
+        instances.emplace(id_, instance);
+        return instance.get();
+    }
+
+private:
+    static std::unordered_map<std::size_t, std::shared_ptr<void>>& thread_instances()
+    {
+        thread_local std::unordered_map<std::size_t, std::shared_ptr<void>> instances;
+        return instances;
+    }
+
+    static std::size_t next_id()
+    {
+        static std::atomic<std::size_t> id{ 0 };
+        return ++id;
+    }
+
+private:
+    factory_t factory_;
+    std::size_t id_;
+};
+
+}
+
+#endif
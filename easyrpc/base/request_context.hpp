@@ -0,0 +1,215 @@
+#ifndef _REQUEST_CONTEXT_H
+#define _REQUEST_CONTEXT_H
+
+#include <chrono>
+#include <cstddef>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace easyrpc
+{
+
+// 客户端取消请求时由连接置位，排队中的请求出队时跳过，执行中的handler可以轮询.
+using cancel_token = std::shared_ptr<std::atomic<bool>>;
+
+inline cancel_token make_cancel_token()
+{
+    return std::make_shared<std::atomic<bool>>(false);
+}
+
+// 合并执行的一组相同请求：deadline取其中最晚的，有一个请求没有deadline整组就没有deadline；
+// 所有请求都取消后整组才算取消，没有cancel_token的请求(单向调用)不可取消.
+class request_group
+{
+public:
+    using clock_type = std::chrono::steady_clock;
+
+    request_group() = default;
+    request_group(const request_group&) = delete;
+    request_group& operator=(const request_group&) = delete;
+
+    void join(clock_type::time_point deadline, const cancel_token& token)
+    {
+        clock_type::rep value = deadline.time_since_epoch().count();
+        clock_type::rep current = deadline_.load();
+        while (current < value && !deadline_.compare_exchange_weak(current, value))
+        {
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        tokens_.emplace_back(token);
+    }
+
+    clock_type::time_point deadline() const
+    {
+        return clock_type::time_point(clock_type::duration(deadline_.load()));
+    }
+
+    bool is_cancelled() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& token : tokens_)
+        {
+            if (token == nullptr || !token->load())
+            {
+                return false;
+            }
+        }
+        return !tokens_.empty();
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::vector<cancel_token> tokens_;
+    std::atomic<clock_type::rep> deadline_{ clock_type::time_point::min().time_since_epoch().count() };
+};
+
+// 正在执行的请求的上下文，由router在调用handler前设置到当前线程上.
+class request_context
+{
+public:
+    using clock_type = std::chrono::steady_clock;
+
+    request_context() = default;
+    request_context(unsigned int request_id, std::size_t budget_milli, const cancel_token& token = nullptr, 
+                    bool one_way = false, unsigned int trace_id = 0)
+        : request_id_(request_id), token_(token), one_way_(one_way), trace_id_(trace_id)
+    {
+        if (budget_milli != 0)
+        {
+            deadline_ = clock_type::now() + std::chrono::milliseconds(budget_milli);
+        }
+    }
+
+    // 合并执行的一组请求共用的上下文，deadline和取消状态随组内的请求变化.
+    request_context(unsigned int request_id, const std::shared_ptr<request_group>& group, unsigned int trace_id = 0)
+        : request_id_(request_id), trace_id_(trace_id), group_(group) {}
+
+    bool has_deadline() const
+    {
+        return deadline() != clock_type::time_point::max();
+    }
+
+    clock_type::time_point deadline() const
+    {
+        return group_ != nullptr ? group_->deadline() : deadline_;
+    }
+
+    bool is_expired() const
+    {
+        return has_deadline() && clock_type::now() >= deadline();
+    }
+
+    std::size_t remaining_milli() const
+    {
+        clock_type::time_point deadline_time = deadline();
+        clock_type::time_point now = clock_type::now();
+        if (deadline_time == clock_type::time_point::max() || now >= deadline_time)
+        {
+            return 0;
+        }
+        return static_cast<std::size_t>(std::chrono::duration_cast<std::chrono::milliseconds>(deadline_time - now).count());
+    }
+
+    unsigned int request_id() const
+    {
+        return request_id_;
+    }
+
+    bool is_cancelled() const
+    {
+        if (group_ != nullptr)
+        {
+            return group_->is_cancelled();
+        }
+        return token_ != nullptr && token_->load();
+    }
+
+    const cancel_token& token() const
+    {
+        return token_;
+    }
+
+    bool is_one_way() const
+    {
+        return one_way_;
+    }
+
+    unsigned int trace_id() const
+    {
+        return trace_id_;
+    }
+
+    // 请求处理完之前需要一直占用的资源(例如请求内存的额度)，最后一份上下文销毁时释放.
+    void hold(const std::shared_ptr<void>& resource)
+    {
+        resource_ = resource;
+    }
+
+    static const request_context*& current()
+    {
+        thread_local const request_context* ctx = nullptr;
+        return ctx;
+    }
+
+private:
+    unsigned int request_id_ = 0;
+    clock_type::time_point deadline_ = clock_type::time_point::max();
+    cancel_token token_;
+    bool one_way_ = false;
+    unsigned int trace_id_ = 0;
+    std::shared_ptr<request_group> group_;
+    std::shared_ptr<void> resource_;
+};
+
+class request_context_scope
+{
+public:
+    request_context_scope(const request_context_scope&) = delete;
+    request_context_scope& operator=(const request_context_scope&) = delete;
+    explicit request_context_scope(const request_context& ctx) : prev_(request_context::current())
+    {
+        request_context::current() = &ctx;
+    }
+
+    ~request_context_scope()
+    {
+        request_context::current() = prev_;
+    }
+
+private:
+    const request_context* prev_;
+};
+
+// 供handler查询调用方剩余的时间预算和是否已取消，handler内发起的下游调用会自动带上deadline.
+namespace this_request
+{
+
+inline bool has_deadline()
+{
+    return request_context::current() != nullptr && request_context::current()->has_deadline();
+}
+
+inline bool is_expired()
+{
+    return request_context::current() != nullptr && request_context::current()->is_expired();
+}
+
+inline bool is_cancelled()
+{
+    return request_context::current() != nullptr && request_context::current()->is_cancelled();
+}
+
+// 没有deadline或者已经超时都返回0，需配合has_deadline/is_expired判断.
+inline std::size_t remaining_milli()
+{
+    return request_context::current() != nullptr ? request_context::current()->remaining_milli() : 0;
+}
+
+}
+
+}
+
+#endif
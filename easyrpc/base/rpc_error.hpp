@@ -0,0 +1,85 @@
+#ifndef _RPC_ERROR_H
+#define _RPC_ERROR_H
+
+#include <string>
+#include <stdexcept>
+#include "header.hpp"
+
+namespace easyrpc
+{
+
+// 服务端以错误状态应答的调用，连接仍然可用；网络错误仍然抛出std::runtime_error.
+class rpc_error : public std::runtime_error
+{
+public:
+    rpc_error(rpc_status status, const std::string& what) : std::runtime_error(what), status_(status) {}
+
+    rpc_status status() const
+    {
+        return status_;
+    }
+
+private:
+    rpc_status status_;
+};
+
+class overloaded_error : public rpc_error
+{
+public:
+    explicit overloaded_error(const std::string& what) : rpc_error(rpc_status::overloaded, what) {}
+};
+
+class not_bound_error : public rpc_error
+{
+public:
+    explicit not_bound_error(const std::string& what) : rpc_error(rpc_status::not_bound, what) {}
+};
+
+class invalid_call_mode_error : public rpc_error
+{
+public:
+    explicit invalid_call_mode_error(const std::string& what) : rpc_error(rpc_status::invalid_call_mode, what) {}
+};
+
+class decode_error : public rpc_error
+{
+public:
+    explicit decode_error(const std::string& what) : rpc_error(rpc_status::decode_error, what) {}
+};
+
+class handler_error : public rpc_error
+{
+public:
+    explicit handler_error(const std::string& what) : rpc_error(rpc_status::handler_error, what) {}
+};
+
+class deadline_exceeded_error : public rpc_error
+{
+public:
+    explicit deadline_exceeded_error(const std::string& what) : rpc_error(rpc_status::deadline_exceeded, what) {}
+};
+
+class cancelled_error : public rpc_error
+{
+public:
+    explicit cancelled_error(const std::string& what) : rpc_error(rpc_status::cancelled, what) {}
+};
+
+inline void throw_rpc_error(rpc_status status, const std::string& what)
+{
+    switch (status)
+    {
+    case rpc_status::overloaded: throw overloaded_error(what.empty() ? "Server overloaded" : what);
+    case rpc_status::not_bound: throw not_bound_error(what);
+    case rpc_status::invalid_call_mode: throw invalid_call_mode_error(what);
+    case rpc_status::decode_error: throw decode_error(what);
+    case rpc_status::handler_error: throw handler_error(what);
+    case rpc_status::deadline_exceeded: throw deadline_exceeded_error(what);
+    case rpc_status::cancelled: throw cancelled_error(what);
+    default: throw rpc_error(status, what);
+    }
+}
+
+}
+
+#endif
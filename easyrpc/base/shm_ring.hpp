@@ -0,0 +1,321 @@
+#ifndef _SHM_RING_H
+#define _SHM_RING_H
+
+#ifdef __linux__
+#define EASYRPC_HAS_SHM_TRANSPORT
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <atomic>
+#include <algorithm>
+#include <string>
+#include <cstdint>
+#include <stdexcept>
+#include <initializer_list>
+#include "header.hpp"
+
+namespace easyrpc
+{
+
+constexpr const std::size_t shm_ring_size = 1024 * 1024;
+constexpr const std::size_t shm_channel_count = 16;
+constexpr const std::uint32_t shm_magic = 0x65727063;
+
+static_assert((shm_ring_size & (shm_ring_size - 1)) == 0, "shm_ring_size must be a power of 2");
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2, "Shared memory rings need lock-free atomics");
+
+inline void futex_wait(std::atomic<std::uint32_t>& word, std::uint32_t expected, std::size_t timeout_milli)
+{
+    timespec ts{ static_cast<time_t>(timeout_milli / 1000), static_cast<long>((timeout_milli % 1000) * 1000000) };
+    // 不使用FUTEX_PRIVATE_FLAG，等待方和唤醒方位于不同进程.
+    syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAIT, expected, &ts, nullptr, 0);
+}
+
+inline void futex_wake(std::atomic<std::uint32_t>& word)
+{
+    syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+struct shm_buffer
+{
+    const void* data;
+    std::size_t len;
+};
+
+// 单生产者单消费者的字节环，head/tail单调递增，位于共享内存中.
+class shm_ring
+{
+public:
+    void reset()
+    {
+        head_.store(0, std::memory_order_relaxed);
+        tail_.store(0, std::memory_order_relaxed);
+    }
+
+    // 整帧写入后才推进head，读端看到的总是完整的帧.
+    bool try_write(std::initializer_list<shm_buffer> buffers)
+    {
+        std::size_t len = 0;
+        for (auto& buf : buffers)
+        {
+            len += buf.len;
+        }
+
+        std::uint64_t head = head_.load(std::memory_order_relaxed);
+        std::uint64_t tail = tail_.load(std::memory_order_acquire);
+        if (shm_ring_size - (head - tail) < len)
+        {
+            return false;
+        }
+
+        for (auto& buf : buffers)
+        {
+            copy_in(head, buf.data, buf.len);
+            head += buf.len;
+        }
+        head_.store(head, std::memory_order_release);
+        return true;
+    }
+
+    std::size_t readable() const
+    {
+        return static_cast<std::size_t>(head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_relaxed));
+    }
+
+    void peek(void* dst, std::size_t len) const
+    {
+        copy_out(tail_.load(std::memory_order_relaxed), dst, len);
+    }
+
+    void read(void* dst, std::size_t len)
+    {
+        std::uint64_t tail = tail_.load(std::memory_order_relaxed);
+        copy_out(tail, dst, len);
+        tail_.store(tail + len, std::memory_order_release);
+    }
+
+private:
+    void copy_in(std::uint64_t pos, const void* src, std::size_t len)
+    {
+        std::size_t offset = static_cast<std::size_t>(pos & (shm_ring_size - 1));
+        std::size_t first = std::min(len, shm_ring_size - offset);
+        memcpy(data_ + offset, src, first);
+        memcpy(data_, static_cast<const char*>(src) + first, len - first);
+    }
+
+    void copy_out(std::uint64_t pos, void* dst, std::size_t len) const
+    {
+        std::size_t offset = static_cast<std::size_t>(pos & (shm_ring_size - 1));
+        std::size_t first = std::min(len, shm_ring_size - offset);
+        memcpy(dst, data_ + offset, first);
+        memcpy(static_cast<char*>(dst) + first, data_, len - first);
+    }
+
+private:
+    alignas(64) std::atomic<std::uint64_t> head_;
+    alignas(64) std::atomic<std::uint64_t> tail_;
+    alignas(64) char data_[shm_ring_size];
+};
+
+enum class shm_channel_state : std::uint32_t
+{
+    free,
+    busy,
+    closing,        // 客户端释放，等待服务端回收
+    closed          // 服务端断开
+};
+
+struct shm_channel
+{
+    std::atomic<std::uint32_t> state;
+    std::atomic<std::int32_t> owner_pid;
+    std::atomic<std::uint32_t> response_seq;
+    std::atomic<std::uint32_t> client_waiting;
+    shm_ring request;
+    shm_ring response;
+};
+
+struct shm_segment_header
+{
+    std::atomic<std::uint32_t> magic;           // 初始化完成后才以release写入
+    std::atomic<std::int32_t> owner_pid;
+    std::uint32_t channel_count;
+    std::atomic<std::uint32_t> doorbell;
+    std::atomic<std::uint32_t> server_waiting;
+};
+
+// 服务端创建，客户端打开；布局为header加上固定数量的channel.
+class shm_segment
+{
+public:
+    shm_segment(const shm_segment&) = delete;
+    shm_segment& operator=(const shm_segment&) = delete;
+    shm_segment(const std::string& name, bool create) : name_(name)
+    {
+        int fd = create ? create_segment() : shm_open(name_.c_str(), O_RDWR, 0600);
+        if (fd == -1)
+        {
+            throw std::runtime_error("Open shared memory failed: " + name_);
+        }
+        is_owner_ = create;
+
+        if (create && ftruncate(fd, static_cast<off_t>(size())) == -1)
+        {
+            close(fd);
+            shm_unlink(name_.c_str());
+            throw std::runtime_error("Resize shared memory failed: " + name_);
+        }
+
+        // 服务端还没来得及设置大小时访问会触发SIGBUS.
+        struct stat st;
+        if (!create && (fstat(fd, &st) == -1 || static_cast<std::size_t>(st.st_size) < size()))
+        {
+            close(fd);
+            throw std::runtime_error("Shared memory format error: " + name_);
+        }
+
+        void* addr = mmap(nullptr, size(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (addr == MAP_FAILED)
+        {
+            if (create)
+            {
+                shm_unlink(name_.c_str());
+            }
+            throw std::runtime_error("Map shared memory failed: " + name_);
+        }
+        addr_ = static_cast<char*>(addr);
+
+        if (create)
+        {
+            init();
+        }
+        else if (header().magic.load(std::memory_order_acquire) != shm_magic || header().channel_count != shm_channel_count)
+        {
+            munmap(addr_, size());
+            throw std::runtime_error("Shared memory format error: " + name_);
+        }
+    }
+
+    ~shm_segment()
+    {
+        munmap(addr_, size());
+        if (is_owner_)
+        {
+            shm_unlink(name_.c_str());
+        }
+    }
+
+    static std::string make_name(const std::string& address)
+    {
+        std::string name = address.substr(shm_prefix.size());
+        if (name.empty() || name == "/")
+        {
+            throw std::invalid_argument("Address format error");
+        }
+        return name[0] == '/' ? name : "/" + name;
+    }
+
+    shm_segment_header& header()
+    {
+        return *reinterpret_cast<shm_segment_header*>(addr_);
+    }
+
+    shm_channel& channel(std::size_t index)
+    {
+        return reinterpret_cast<shm_channel*>(addr_ + channel_offset())[index];
+    }
+
+private:
+    static constexpr std::size_t channel_offset()
+    {
+        return (sizeof(shm_segment_header) + 63) / 64 * 64;
+    }
+
+    static constexpr std::size_t size()
+    {
+        return channel_offset() + sizeof(shm_channel) * shm_channel_count;
+    }
+
+    // 同名的段仍属于存活的服务端时失败，不会把正在使用的段重置；服务端崩溃后遗留的段删除后重新创建.
+    int create_segment() const
+    {
+        int fd = shm_open(name_.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd != -1 || errno != EEXIST)
+        {
+            return fd;
+        }
+
+        if (is_owner_alive())
+        {
+            throw std::runtime_error("Shared memory in use: " + name_);
+        }
+        shm_unlink(name_.c_str());
+        return shm_open(name_.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    }
+
+    bool is_owner_alive() const
+    {
+        int fd = shm_open(name_.c_str(), O_RDONLY, 0);
+        if (fd == -1)
+        {
+            return false;
+        }
+
+        bool alive = false;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && static_cast<std::size_t>(st.st_size) >= sizeof(shm_segment_header))
+        {
+            void* addr = mmap(nullptr, sizeof(shm_segment_header), PROT_READ, MAP_SHARED, fd, 0);
+            if (addr != MAP_FAILED)
+            {
+                auto head = static_cast<const shm_segment_header*>(addr);
+                pid_t pid = head->owner_pid.load(std::memory_order_relaxed);
+                alive = head->magic.load(std::memory_order_acquire) == shm_magic && pid > 0 && 
+                    !(kill(pid, 0) == -1 && errno == ESRCH);
+                munmap(addr, sizeof(shm_segment_header));
+            }
+        }
+        close(fd);
+        return alive;
+    }
+
+    void init()
+    {
+        header().magic.store(0, std::memory_order_relaxed);
+        header().owner_pid.store(static_cast<std::int32_t>(getpid()), std::memory_order_relaxed);
+        header().channel_count = shm_channel_count;
+        header().doorbell.store(0);
+        header().server_waiting.store(0);
+        for (std::size_t i = 0; i < shm_channel_count; ++i)
+        {
+            shm_channel& ch = channel(i);
+            ch.owner_pid.store(0);
+            ch.response_seq.store(0);
+            ch.client_waiting.store(0);
+            ch.request.reset();
+            ch.response.reset();
+            ch.state.store(static_cast<std::uint32_t>(shm_channel_state::free));
+        }
+        header().magic.store(shm_magic, std::memory_order_release);
+    }
+
+private:
+    std::string name_;
+    bool is_owner_ = false;
+    char* addr_ = nullptr;
+};
+
+}
+
+#endif
+#endif
@@ -2,26 +2,44 @@
 #define _THREADPOOL_H
 
 #include <vector>
-#include <queue>
+#include <deque>
 #include <thread>
+#include <chrono>
 #include <mutex>
 #include <memory>
 #include <functional>
 #include <condition_variable>
 #include <atomic>
 #include <type_traits>
+#include <algorithm>
+#include "thread_util.hpp"
+#include "header.hpp"
+#include "fair_queue.hpp"
 
 namespace easyrpc
 {
 
 static const std::size_t max_task_quque_size = 100000;
 static const std::size_t max_thread_size = 30;
+static const std::size_t default_priority_aging_milli = 100;
+static const std::size_t max_adaptive_thread_size = 1024;
+static const std::size_t default_worker_idle_milli = 10000;
+static const std::size_t worker_grow_interval_milli = 10;
+
+// 任务队列满(或队首任务排队过久)时的处理方式.
+enum class overload_policy
+{
+    block,          // 阻塞提交任务的线程
+    reject,         // 拒绝新任务
+    drop_oldest     // 丢弃最早的任务，低优先级的先丢弃
+};
 
 class thread_pool
 {
 public:
     using work_thread_ptr = std::shared_ptr<std::thread>;
     using task_t = std::function<void()>; 
+    using clock_type = std::chrono::steady_clock;
 
     explicit thread_pool() : is_stop_threadpool_(false) {}
 
@@ -30,19 +48,123 @@ public:
         stop();
     }
 
+    // 自适应模式下num为初始线程数，限制在[min_threads, max_threads]内.
     void init_thread_num(std::size_t num)
     {
-        if (num <= 0 || num > max_thread_size)
+        std::size_t max_num = is_adaptive_ ? max_threads_ : max_thread_size;
+        if (is_adaptive_)
+        {
+            num = std::min(std::max(num, min_threads_), max_threads_);
+        }
+
+        if (num <= 0 || num > max_num)
         {
-            std::string str = "Number of threads in the range of 1 to " + std::to_string(max_thread_size);
+            std::string str = "Number of threads in the range of 1 to " + std::to_string(max_num);
             throw std::invalid_argument(str);
         }
 
+        std::lock_guard<std::mutex> locker(task_queue_mutex_);
         for (std::size_t i = 0; i < num; ++i)
         {
-            work_thread_ptr t = std::make_shared<std::thread>(std::bind(&thread_pool::run_task, this));
-            thread_vec_.emplace_back(t);
+            start_worker();
+        }
+    }
+
+    // 自适应模式：任务排队超过target_queue_wait_milli而且没有空闲线程时(handler阻塞在I/O上也是如此)增加线程，
+    // 线程空闲超过idle_milli时退出，线程数在[min_threads, max_threads]之间，不受max_thread_size限制；
+    // 需在init_thread_num之前调用.
+    void set_adaptive(std::size_t min_threads, std::size_t max_threads, std::size_t target_queue_wait_milli, 
+                      std::size_t idle_milli = default_worker_idle_milli)
+    {
+        if (min_threads == 0 || min_threads > max_threads || max_threads > max_adaptive_thread_size)
+        {
+            throw std::invalid_argument("Adaptive threads in the range of 1 to " + std::to_string(max_adaptive_thread_size));
+        }
+
+        // 空闲等待为0时worker一没有任务就退出，线程反复创建销毁.
+        if (idle_milli == 0)
+        {
+            throw std::invalid_argument("Worker idle time must be greater than 0");
+        }
+
+        std::lock_guard<std::mutex> locker(task_queue_mutex_);
+        is_adaptive_ = true;
+        min_threads_ = min_threads;
+        max_threads_ = max_threads;
+        target_queue_wait_ = std::chrono::milliseconds(target_queue_wait_milli);
+        worker_idle_ = std::chrono::milliseconds(idle_milli);
+    }
+
+    std::size_t thread_count()
+    {
+        std::lock_guard<std::mutex> locker(task_queue_mutex_);
+        return thread_vec_.size();
+    }
+
+    // 所有worker线程都绑定在这组CPU上，需在init_thread_num之前调用.
+    void set_cpus(const std::vector<std::size_t>& cpus)
+    {
+        cpus_ = cpus;
+    }
+
+    // max_queue_wait_milli为0表示不按排队时间丢弃.
+    void set_overload_policy(overload_policy policy, std::size_t max_queue_size, std::size_t max_queue_wait_milli)
+    {
+        std::lock_guard<std::mutex> locker(task_queue_mutex_);
+        policy_ = policy;
+        max_queue_size_ = max_queue_size == 0 ? max_task_quque_size : max_queue_size;
+        max_queue_wait_ = std::chrono::milliseconds(max_queue_wait_milli);
+    }
+
+    // 低一级优先级的任务多排队aging_milli才与高一级的任务同等对待，为0时各优先级按到达顺序执行.
+    void set_priority_aging(std::size_t aging_milli)
+    {
+        std::lock_guard<std::mutex> locker(task_queue_mutex_);
+        priority_aging_ = std::chrono::milliseconds(aging_milli);
+    }
+
+    // 任务被拒绝时返回false；已入队的任务若被丢弃则调用discard，而不是task.
+    // 同一优先级内按flow轮流出队，cost越大占用的轮次越多，flow都为0时先进先出.
+    bool submit(const task_t& task, const task_t& discard, priority prio = priority::normal, 
+                std::uint64_t flow = 0, std::size_t cost = 1)
+    {
+        if (is_stop_threadpool_)
+        {
+            return false;
+        }
+
+        queued_task dropped;
+        {
+            std::unique_lock<std::mutex> locker(task_queue_mutex_);
+            if (policy_ == overload_policy::block)
+            {
+                while (task_count_ >= max_queue_size_ && !is_stop_threadpool_)
+                {
+                    task_put_.wait(locker);
+                }
+            }
+            else if (is_overloaded())
+            {
+                if (policy_ == overload_policy::reject)
+                {
+                    return false;
+                }
+                // 优先丢弃低优先级中排队最多的flow最早的任务.
+                dropped = task_queue_[lowest_nonempty_queue()].take_from_largest();
+                --task_count_;
+            }
+
+            task_queue_[queue_index(prio)].push_back({ task, discard, clock_type::now() }, flow, cost);
+            ++task_count_;
+            adapt();
+        }
+
+        task_get_.notify_one();
+        if (dropped.discard != nullptr)
+        {
+            dropped.discard();
         }
+        return true;
     }
 
     template<typename Function, typename... Args>
@@ -81,27 +203,172 @@ public:
     }
 
 private:
+    struct queued_task
+    {
+        task_t task;
+        task_t discard;
+        clock_type::time_point enqueue_time;
+    };
+
     void add_task_impl(const task_t& task)
     {
+        submit(task, nullptr);
+    }
+
+    // 调用方需持有task_queue_mutex_.
+    void start_worker()
+    {
+        work_thread_ptr t = std::make_shared<std::thread>(std::bind(&thread_pool::run_task, this));
+        if (!cpus_.empty())
         {
-            std::unique_lock<std::mutex> locker(task_queue_mutex_);
-            while (task_queue_.size() == max_task_quque_size && !is_stop_threadpool_)
+            thread_util::set_affinity(*t, cpus_);
+        }
+        thread_vec_.emplace_back(t);
+    }
+
+    // 调用方需持有task_queue_mutex_；所有线程都在忙并且排队最久的任务超过目标时间时增加一个线程.
+    void adapt()
+    {
+        if (!is_adaptive_ || idle_threads_ != 0 || thread_vec_.size() >= max_threads_ || is_stop_threadpool_)
+        {
+            return;
+        }
+
+        auto now = clock_type::now();
+        if (now - last_grow_time_ < std::chrono::milliseconds(worker_grow_interval_milli))
+        {
+            return;
+        }
+
+        for (auto& queue : task_queue_)
+        {
+            if (!queue.empty() && now - queue.oldest().enqueue_time >= target_queue_wait_)
             {
-                task_put_.wait(locker);
+                reap_workers();
+                start_worker();
+                last_grow_time_ = now;
+                return;
             }
+        }
+    }
 
-            task_queue_.emplace(std::move(task));
+    // 调用方需持有task_queue_mutex_；空闲太久的线程把自己移到retired_中，由别的线程join.
+    bool retire_worker()
+    {
+        if (!is_adaptive_ || thread_vec_.size() <= min_threads_ || is_stop_threadpool_)
+        {
+            return false;
         }
 
-        task_get_.notify_one();
+        auto id = std::this_thread::get_id();
+        for (auto iter = thread_vec_.begin(); iter != thread_vec_.end(); ++iter)
+        {
+            if ((*iter)->get_id() == id)
+            {
+                retired_vec_.emplace_back(*iter);
+                thread_vec_.erase(iter);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // 调用方需持有task_queue_mutex_.
+    void reap_workers()
+    {
+        auto id = std::this_thread::get_id();
+        for (auto iter = retired_vec_.begin(); iter != retired_vec_.end();)
+        {
+            if ((*iter)->get_id() != id && (*iter)->joinable())
+            {
+                (*iter)->join();
+                iter = retired_vec_.erase(iter);
+            }
+            else
+            {
+                ++iter;
+            }
+        }
+    }
+
+    // 请求头中的优先级收到时已经校验，非法值在这里按normal处理.
+    static std::size_t queue_index(priority prio)
+    {
+        if (prio == priority::unspecified || !is_valid_priority(prio))
+        {
+            prio = priority::normal;
+        }
+        return static_cast<std::size_t>(prio) - static_cast<std::size_t>(priority::high);
+    }
+
+    std::size_t lowest_nonempty_queue() const
+    {
+        std::size_t index = priority_count - 1;
+        while (index > 0 && task_queue_[index].empty())
+        {
+            --index;
+        }
+        return index;
+    }
+
+    // 各队列队首中入队时间加上优先级惩罚最早的那个，高优先级优先，低优先级等得足够久也能轮到.
+    std::size_t next_queue() const
+    {
+        std::size_t next = priority_count;
+        clock_type::time_point next_time = clock_type::time_point::max();
+        for (std::size_t i = 0; i < priority_count; ++i)
+        {
+            if (task_queue_[i].empty())
+            {
+                continue;
+            }
+
+            clock_type::time_point time = task_queue_[i].oldest().enqueue_time + priority_aging_ * i;
+            if (time < next_time)
+            {
+                next = i;
+                next_time = time;
+            }
+        }
+        return next;
+    }
+
+    bool is_overloaded() const
+    {
+        if (task_count_ >= max_queue_size_)
+        {
+            return true;
+        }
+
+        for (auto& queue : task_queue_)
+        {
+            if (!queue.empty() && is_expired(queue.oldest()))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool is_expired(const queued_task& item) const
+    {
+        return max_queue_wait_.count() != 0 && clock_type::now() - item.enqueue_time > max_queue_wait_;
     }
 
     void terminate_all()
     {
-        is_stop_threadpool_ = true;
+        std::vector<work_thread_ptr> threads;
+        {
+            std::lock_guard<std::mutex> locker(task_queue_mutex_);
+            is_stop_threadpool_ = true;
+            threads.swap(thread_vec_);
+            threads.insert(threads.end(), retired_vec_.begin(), retired_vec_.end());
+            retired_vec_.clear();
+        }
         task_get_.notify_all();
+        task_put_.notify_all();
 
-        for (auto& iter : thread_vec_)
+        for (auto& iter : threads)
         {
             if (iter != nullptr)
             {
@@ -111,7 +378,6 @@ private:
                 }
             }
         }
-        thread_vec_.clear();
 
         clean_task_queue();
     }
@@ -120,29 +386,58 @@ private:
     {
         while (true)
         {
-            task_t task = nullptr;
+            queued_task item;
             {
                 std::unique_lock<std::mutex> locker(task_queue_mutex_);
-                while (task_queue_.empty() && !is_stop_threadpool_)
+                bool is_retired = false;
+                while (task_count_ == 0 && !is_stop_threadpool_)
                 {
-                    task_get_.wait(locker);
+                    ++idle_threads_;
+                    if (is_adaptive_)
+                    {
+                        auto status = task_get_.wait_for(locker, worker_idle_);
+                        is_retired = status == std::cv_status::timeout && task_count_ == 0 && retire_worker();
+                    }
+                    else
+                    {
+                        task_get_.wait(locker);
+                    }
+                    --idle_threads_;
+                    if (is_retired)
+                    {
+                        break;
+                    }
                 }
 
-                if (is_stop_threadpool_)
+                if (is_stop_threadpool_ || is_retired)
                 {
                     break;
                 }
 
-                if (!task_queue_.empty())
+                std::size_t index = next_queue();
+                if (index != priority_count)
                 {
-                    task = std::move(task_queue_.front());
-                    task_queue_.pop();
+                    item = std::move(task_queue_[index].front());
+                    task_queue_[index].pop_front();
+                    --task_count_;
+                    adapt();
                 }
             }
 
-            if (task != nullptr)
+            if (item.task != nullptr)
             {
-                task();
+                if (is_expired(item))
+                {
+                    // 排队太久，调用方大概率已经放弃，直接丢弃.
+                    if (item.discard != nullptr)
+                    {
+                        item.discard();
+                    }
+                }
+                else
+                {
+                    item.task();
+                }
                 task_put_.notify_one();
             }
         }
@@ -151,10 +446,11 @@ private:
     void clean_task_queue()
     {
         std::lock_guard<std::mutex> locker(task_queue_mutex_);
-        while (!task_queue_.empty())
+        for (auto& queue : task_queue_)
         {
-            task_queue_.pop();
+            queue.clear();
         }
+        task_count_ = 0;
     }
 
 private:
@@ -162,9 +458,24 @@ private:
     std::condition_variable task_put_;
     std::condition_variable task_get_;
     std::mutex task_queue_mutex_;
-    std::queue<task_t> task_queue_;
+    static const std::size_t priority_count = 3;
+    fair_queue<queued_task> task_queue_[priority_count];     // 下标0为priority::high
+    std::size_t task_count_ = 0;
     std::atomic<bool> is_stop_threadpool_;
     std::once_flag call_flag_;
+    std::vector<std::size_t> cpus_;
+    overload_policy policy_ = overload_policy::block;
+    std::size_t max_queue_size_ = max_task_quque_size;
+    std::chrono::milliseconds max_queue_wait_{ 0 };
+    std::chrono::milliseconds priority_aging_{ default_priority_aging_milli };
+    std::vector<work_thread_ptr> retired_vec_;
+    std::size_t idle_threads_ = 0;
+    bool is_adaptive_ = false;
+    std::size_t min_threads_ = 1;
+    std::size_t max_threads_ = max_thread_size;
+    std::chrono::milliseconds target_queue_wait_{ 0 };
+    std::chrono::milliseconds worker_idle_{ default_worker_idle_milli };
+    clock_type::time_point last_grow_time_;
 };
 
 }
@@ -0,0 +1,105 @@
+#ifndef _THREAD_UTIL_H
+#define _THREAD_UTIL_H
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <vector>
+#include <thread>
+#include <string>
+#include <fstream>
+#include "string_util.hpp"
+
+namespace easyrpc
+{
+
+class thread_util
+{
+public:
+    static bool set_affinity(std::thread& t, const std::vector<std::size_t>& cpus)
+    {
+#ifdef __linux__
+        if (cpus.empty())
+        {
+            return false;
+        }
+
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        for (auto& cpu : cpus)
+        {
+            CPU_SET(cpu, &cpu_set);
+        }
+        return pthread_setaffinity_np(t.native_handle(), sizeof(cpu_set), &cpu_set) == 0;
+#else
+        return false;
+#endif
+    }
+
+    static std::size_t cpu_count()
+    {
+        std::size_t count = std::thread::hardware_concurrency();
+        return count == 0 ? 1 : count;
+    }
+
+    static std::vector<std::size_t> all_cpus()
+    {
+        std::vector<std::size_t> cpus;
+        for (std::size_t i = 0; i < cpu_count(); ++i)
+        {
+            cpus.emplace_back(i);
+        }
+        return cpus;
+    }
+
+    // 读取/sys/devices/system/node/nodeN/cpulist，格式如"0-15,32-47".
+    static std::vector<std::size_t> numa_node_cpus(std::size_t node)
+    {
+        std::vector<std::size_t> cpus;
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        std::string cpu_list;
+        if (!std::getline(file, cpu_list))
+        {
+            return cpus;
+        }
+
+        for (auto& range : string_util::split(string_util::trim(cpu_list), ","))
+        {
+            std::vector<std::string> token = string_util::split(range, "-");
+            std::size_t first = std::stoul(token[0]);
+            std::size_t last = token.size() == 2 ? std::stoul(token[1]) : first;
+            for (std::size_t cpu = first; cpu <= last; ++cpu)
+            {
+                cpus.emplace_back(cpu);
+            }
+        }
+        return cpus;
+    }
+
+    // 下标为cpu编号，值为所在的NUMA节点，未知(非NUMA机器或者非Linux)为-1.
+    static std::vector<int> cpu_numa_nodes()
+    {
+        std::vector<int> nodes(cpu_count(), -1);
+        for (std::size_t node = 0; node < max_numa_nodes; ++node)
+        {
+            for (auto& cpu : numa_node_cpus(node))
+            {
+                if (cpu >= nodes.size())
+                {
+                    nodes.resize(cpu + 1, -1);
+                }
+                nodes[cpu] = static_cast<int>(node);
+            }
+        }
+        return nodes;
+    }
+
+private:
+    static const std::size_t max_numa_nodes = 64;
+};
+
+}
+
+#endif
@@ -0,0 +1,205 @@
+#ifndef _TRACER_H
+#define _TRACER_H
+
+#include <vector>
+#include <string>
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <unordered_map>
+#include <unistd.h>
+
+namespace easyrpc
+{
+
+static const std::size_t default_trace_ring_size = 16384;
+
+// 一个请求依次经过的时间点，client_xxx在客户端进程记录.
+enum class trace_point : unsigned int
+{
+    client_send,
+    accept,
+    header_read,
+    body_read,
+    enqueue,
+    dequeue,
+    handler_start,
+    handler_end,
+    write_complete,
+    client_receive
+};
+
+inline const char* trace_point_name(trace_point point)
+{
+    static const char* names[] = { "client_send", "accept", "header_read", "body_read", "enqueue",
+                                   "dequeue", "handler_start", "handler_end", "write_complete", "client_receive" };
+    return names[static_cast<unsigned int>(point)];
+}
+
+// 按trace_id记录请求经过各个时间点的时刻，每个线程写自己的环形缓冲，旧的记录被覆盖；
+// trace_id由客户端生成并放在请求头里，服务端对没有trace_id的请求自己生成一个.
+class tracer
+{
+public:
+    using clock_type = std::chrono::steady_clock;
+
+    tracer(const tracer&) = delete;
+    tracer& operator=(const tracer&) = delete;
+
+    static tracer& instance()
+    {
+        static tracer t;
+        return t;
+    }
+
+    // ring_size为每个线程保留的最近记录数，需在开启之前设置.
+    void enable(std::size_t ring_size = default_trace_ring_size)
+    {
+        ring_size_ = ring_size == 0 ? 1 : ring_size;
+        is_enabled_ = true;
+    }
+
+    void disable()
+    {
+        is_enabled_ = false;
+    }
+
+    bool is_enabled() const
+    {
+        return is_enabled_.load(std::memory_order_relaxed);
+    }
+
+    // 0表示不跟踪.
+    unsigned int next_trace_id()
+    {
+        thread_local std::minstd_rand engine(std::random_device{}());
+        unsigned int id = 0;
+        while (id == 0)
+        {
+            id = static_cast<unsigned int>(engine());
+        }
+        return id;
+    }
+
+    void record(unsigned int trace_id, unsigned int request_id, trace_point point,
+                clock_type::time_point time = clock_type::now())
+    {
+        if (trace_id == 0 || !is_enabled())
+        {
+            return;
+        }
+
+        ring& r = thread_ring();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        r.events[r.next % r.events.size()] = { trace_id, request_id, point, time };
+        ++r.next;
+    }
+
+    // 同一trace_id的相邻时间点之间输出一个区间，每个请求在Chrome trace viewer(chrome://tracing)中占一行.
+    std::string dump_chrome_trace()
+    {
+        std::unordered_map<unsigned int, std::vector<event>> traces;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (auto& r : rings_)
+            {
+                std::lock_guard<std::mutex> ring_lock(r->mutex);
+                std::size_t count = std::min(r->next, r->events.size());
+                for (std::size_t i = r->next - count; i < r->next; ++i)
+                {
+                    const event& e = r->events[i % r->events.size()];
+                    traces[e.trace_id].emplace_back(e);
+                }
+            }
+        }
+
+        std::string json = "{\"traceEvents\":[";
+        std::string pid = std::to_string(::getpid());
+        bool is_first = true;
+        for (auto& iter : traces)
+        {
+            auto& events = iter.second;
+            std::sort(events.begin(), events.end(), [](const event& a, const event& b)
+            {
+                return a.time != b.time ? a.time < b.time : a.point < b.point;
+            });
+
+            for (std::size_t i = 0; i + 1 < events.size(); ++i)
+            {
+                if (!is_first)
+                {
+                    json += ",";
+                }
+                is_first = false;
+                json += "{\"name\":\"" + std::string(trace_point_name(events[i].point)) + " -> " +
+                        trace_point_name(events[i + 1].point) + "\",\"cat\":\"easyrpc\",\"ph\":\"X\",\"ts\":" +
+                        std::to_string(to_micro(events[i].time)) + ",\"dur\":" +
+                        std::to_string(to_micro(events[i + 1].time) - to_micro(events[i].time)) +
+                        ",\"pid\":" + pid + ",\"tid\":" + std::to_string(iter.first) +
+                        ",\"args\":{\"request_id\":" + std::to_string(events[i].request_id) + "}}";
+            }
+        }
+        json += "],\"displayTimeUnit\":\"ms\"}";
+        return json;
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& r : rings_)
+        {
+            std::lock_guard<std::mutex> ring_lock(r->mutex);
+            r->next = 0;
+        }
+    }
+
+private:
+    tracer() = default;
+
+    struct event
+    {
+        unsigned int trace_id;
+        unsigned int request_id;
+        trace_point point;
+        clock_type::time_point time;
+    };
+
+    // 只有所属线程写入，导出时才有竞争，锁基本不会冲突.
+    struct ring
+    {
+        std::mutex mutex;
+        std::vector<event> events;
+        std::size_t next = 0;
+    };
+
+    ring& thread_ring()
+    {
+        thread_local std::shared_ptr<ring> r;
+        if (r == nullptr)
+        {
+            r = std::make_shared<ring>();
+            r->events.resize(ring_size_);
+            std::lock_guard<std::mutex> lock(mutex_);
+            rings_.emplace_back(r);
+        }
+        return *r;
+    }
+
+    static long long to_micro(clock_type::time_point time)
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(time.time_since_epoch()).count();
+    }
+
+private:
+    std::atomic<bool> is_enabled_{ false };
+    std::size_t ring_size_ = default_trace_ring_size;
+    std::mutex mutex_;
+    std::vector<std::shared_ptr<ring>> rings_;
+};
+
+}
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef _CALL_FUTURE_H
+#define _CALL_FUTURE_H
+
+#include <vector>
+#include <chrono>
+#include <functional>
+#include "rpc_session.hpp"
+
+namespace easyrpc
+{
+
+// async_call的返回值，get()等待应答并反序列化，超时后自动取消.
+template<typename ReturnType>
+class call_future
+{
+public:
+    using decoder_t = std::function<ReturnType(const std::vector<char>&)>;
+    call_future(const call_future&) = delete;
+    call_future& operator=(const call_future&) = delete;
+    call_future(call_future&&) = default;
+    call_future& operator=(call_future&&) = default;
+    call_future(rpc_session& session, pending_call&& call, const decoder_t& decoder)
+        : session_(&session), call_(std::move(call)), decoder_(decoder) {}
+
+    ReturnType get()
+    {
+        return decoder_(session_->wait(call_));
+    }
+
+    bool is_ready() const
+    {
+        return call_.future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
+
+    // 应答已经到达时什么也不做，否则get()抛出cancelled_error.
+    void cancel()
+    {
+        session_->cancel(call_.request_id);
+    }
+
+    unsigned int request_id() const
+    {
+        return call_.request_id;
+    }
+
+private:
+    rpc_session* session_;
+    pending_call call_;
+    decoder_t decoder_;
+};
+
+}
+
+#endif
@@ -1,10 +1,16 @@
 #ifndef _CLIENT_H
 #define _CLIENT_H
 
-#include <mutex>
+#include <unordered_map>
 #include "base/string_util.hpp"
 #include "protocol.hpp"
 #include "rpc_session.hpp"
+#include "load_balancer.hpp"
+#include "hash_ring.hpp"
+#include "retry_budget.hpp"
+#include "result_cache.hpp"
+#include "client_metrics.hpp"
+#include "call_future.hpp"
 
 namespace easyrpc
 {
@@ -22,12 +28,20 @@ public:
 
     client& connect(const std::string& address)
     {
-        std::vector<std::string> token = string_util::split(address, ":");
-        if (token.size() != 2)
+        balancer_.clear();
+        balancer_.add(make_session(address), address);
+        return *this;
+    }
+
+    // 同时连接多个server，每次调用按balance_policy选择其中一个.
+    client& connect(const std::vector<std::string>& addresses)
+    {
+        balancer_.clear();
+        for (auto& address : addresses)
         {
-            throw std::invalid_argument("Address format error");
+            balancer_.add(make_session(address), address);
         }
-        return connect(token[0], token[1]);
+        return *this;
     }
 
     client& connect(const std::string& ip, unsigned short port)
@@ -37,73 +51,430 @@ public:
 
     client& connect(const std::string& ip, const std::string& port)
     {
-        session_.connect(ip, port);
-        return *this;
+        return connect(ip + ":" + port);
     }
 
     client& timeout(std::size_t timeout_milli)
     {
-        session_.timeout(timeout_milli);
+        timeout_milli_ = timeout_milli;
+        for (auto& session : balancer_.sessions())
+        {
+            session->timeout(timeout_milli);
+        }
+        return *this;
+    }
+
+    // 批处理类的调用方可以设为priority::low，让出worker给交互请求.
+    client& priority(easyrpc::priority prio)
+    {
+        priority_ = prio;
+        for (auto& session : balancer_.sessions())
+        {
+            session->set_priority(prio);
+        }
+        return *this;
+    }
+
+    client& balance(balance_policy policy)
+    {
+        balancer_.set_policy(policy);
         return *this;
     }
 
+    // call在percentile分位的时延内还没有应答时，向另一个server再发一份，先到的结果生效，另一个被取消；
+    // 要求handler是幂等的，为0时关闭.
+    client& hedge(double percentile)
+    {
+        hedge_percentile_ = percentile;
+        return *this;
+    }
+
+    // 对冲请求消耗的令牌：每个调用存入ratio个，另外每秒补充min_per_second个，最多攒max_tokens个.
+    client& retry_budget(double ratio, double min_per_second, double max_tokens)
+    {
+        retry_budget_.set(ratio, min_per_second, max_tokens);
+        return *this;
+    }
+
+    // 该协议的调用按extractor从参数中取出的key做一致性哈希，同一个key总是发给同一个server，
+    // 例如hash_by(query_person_info, [](const person_info_req& req){ return req.card_id; }).
+    template<typename Protocol, typename Extractor>
+    client& hash_by(const Protocol& protocol, const Extractor& extractor)
+    {
+        auto ptr = std::make_shared<key_extractor<typename Protocol::function_type>>();
+        ptr->func = [extractor](const auto&... args){ return to_hash_key(extractor(args...)); };
+        key_extractors_[protocol.name()] = ptr;
+        return *this;
+    }
+
+    // 该协议call的结果在本地缓存ttl_milli，命中时不产生任何网络请求；只应对参考数据一类的查询开启.
+    template<typename Protocol>
+    client& cache(const Protocol& protocol, std::size_t ttl_milli)
+    {
+        cache_.enable(protocol.name(), ttl_milli);
+        return *this;
+    }
+
+    // 所有协议缓存的结果总数上限，超过时淘汰最久未使用的.
+    client& cache_size(std::size_t max_entries)
+    {
+        cache_.set_max_entries(max_entries);
+        return *this;
+    }
+
+    // 数据源变更时由调用方使缓存的结果失效.
+    template<typename Protocol, typename... Args>
+    void invalidate(const Protocol& protocol, Args&&... args)
+    {
+        cache_.invalidate(result_cache::make_key(protocol.name(), protocol.pack(std::forward<Args>(args)...)));
+    }
+
+    template<typename Protocol>
+    void invalidate_all(const Protocol& protocol)
+    {
+        cache_.invalidate_protocol(protocol.name());
+    }
+
+    void clear_cache()
+    {
+        cache_.clear();
+    }
+
+    // 单向调用在每个连接上合并写出，见rpc_session::batch_one_way，max_batch_bytes为0时关闭.
+    client& batch_one_way(std::size_t max_batch_bytes, std::size_t max_delay_micro)
+    {
+        max_batch_bytes_ = max_batch_bytes;
+        max_batch_delay_micro_ = max_delay_micro;
+        for (auto& session : balancer_.sessions())
+        {
+            session->batch_one_way(max_batch_bytes, max_delay_micro);
+        }
+        return *this;
+    }
+
+    // 低时延模式，见rpc_session::busy_poll，需在run之前调用.
+    client& busy_poll(std::size_t spin_micro, std::size_t socket_busy_poll_micro = 0)
+    {
+        spin_micro_ = spin_micro;
+        socket_busy_poll_micro_ = socket_busy_poll_micro;
+        for (auto& session : balancer_.sessions())
+        {
+            session->busy_poll(spin_micro, socket_busy_poll_micro);
+        }
+        return *this;
+    }
+
+    // 立即写出各连接上攒着的单向调用.
+    void flush()
+    {
+        for (auto& session : balancer_.sessions())
+        {
+            session->flush();
+        }
+    }
+
+    // 所有连接共用的耗时和计数，可以在调用进行中随时读取.
+    const client_metrics& metrics() const
+    {
+        return metrics_;
+    }
+
     void run()
     {
-        session_.run();
+        balancer_.run();
     }
 
     void stop()
     {
-        session_.stop();
+        balancer_.stop();
+    }
+
+    template<typename Protocol, typename... Args>
+    typename Protocol::return_type call(const Protocol& protocol, Args&&... args)
+    {
+        bool is_hedged = hedge_percentile_ != 0 && balancer_.sessions().size() >= 2;
+        if (!is_hedged && !cache_.is_enabled(protocol.name()))
+        {
+            return async_call(protocol, std::forward<Args>(args)...).get();
+        }
+
+        std::string body = protocol.pack(args...);
+        std::string key = result_cache::make_key(protocol.name(), body);
+        std::vector<char> ret;
+        if (cache_.get(key, ret))
+        {
+            return make_decoder(protocol)(ret);
+        }
+
+        std::uint64_t generation = cache_.generation(protocol.name());
+        rpc_session& session = pick_session(protocol, args...);
+        if (is_hedged)
+        {
+            ret = hedged_call(session, protocol.name(), call_mode::non_raw, body);
+        }
+        else
+        {
+            ret = session.call(protocol.name(), call_mode::non_raw, body);
+        }
+        cache_.put(protocol.name(), key, ret, generation);
+        return make_decoder(protocol)(ret);
     }
 
+    // 多个线程可以共用一个client，请求在同一连接上并发进行.
     template<typename Protocol, typename... Args>
-    typename std::enable_if<std::is_void<typename Protocol::return_type>::value, typename Protocol::return_type>::type
-    call(const Protocol& protocol, Args&&... args)
+    call_future<typename Protocol::return_type> async_call(const Protocol& protocol, Args&&... args)
     {
-        std::lock_guard<std::mutex> lock(mutex_);
-        session_.connect();
-        auto guard = make_guard([this]{ session_.disconnect(); });
-        // 读取到buf后不进行任何处理，因为client建立的短连接.
-        // 需要server端进行确认后才能断开连接.
-        session_.call(protocol.name(), call_mode::non_raw, protocol.pack(std::forward<Args>(args)...));
+        rpc_session& session = pick_session(protocol, args...);
+        auto call = session.async_call(protocol.name(), call_mode::non_raw, protocol.pack(std::forward<Args>(args)...));
+        return call_future<typename Protocol::return_type>(session, std::move(call), make_decoder(protocol));
     }
 
+    // 不等待应答，也不占用server的应答带宽；handler的返回值和异常都被丢弃.
+    // 只有send和call_raw<one_way>是单向调用，返回void的协议用call调用(如call(say_hello))仍然一应一答，等待server执行完.
     template<typename Protocol, typename... Args>
-    typename std::enable_if<!std::is_void<typename Protocol::return_type>::value, typename Protocol::return_type>::type
-    call(const Protocol& protocol, Args&&... args)
+    void send(const Protocol& protocol, Args&&... args)
     {
-        std::lock_guard<std::mutex> lock(mutex_);
-        session_.connect();
-        auto guard = make_guard([this]{ session_.disconnect(); });
-        auto ret = session_.call(protocol.name(), call_mode::non_raw, protocol.pack(std::forward<Args>(args)...));
-        return protocol.unpack(std::string(&ret[0], ret.size()));
+        rpc_session& session = pick_session(protocol, args...);
+        session.send(protocol.name(), call_mode::non_raw, protocol.pack(std::forward<Args>(args)...));
     }
 
     template<typename ReturnType>
     typename std::enable_if<std::is_same<ReturnType, one_way>::value>::type 
     call_raw(const std::string& protocol, const std::string& body)
     {
-        std::lock_guard<std::mutex> lock(mutex_);
-        session_.connect();
-        auto guard = make_guard([this]{ session_.disconnect(); });
-        session_.call(protocol, call_mode::raw, body);
+        balancer_.pick().send(protocol, call_mode::raw, body);
     }
 
     template<typename ReturnType>
     typename std::enable_if<std::is_same<ReturnType, two_way>::value, std::string>::type 
     call_raw(const std::string& protocol, const std::string& body)
     {
-        std::lock_guard<std::mutex> lock(mutex_);
-        session_.connect();
-        auto guard = make_guard([this]{ session_.disconnect(); });
-        auto ret = session_.call(protocol, call_mode::raw, body);
-        return std::string(&ret[0], ret.size());
+        return async_call_raw(protocol, body).get();
+    }
+
+    call_future<two_way> async_call_raw(const std::string& protocol, const std::string& body)
+    {
+        rpc_session& session = balancer_.pick();
+        auto call = session.async_call(protocol, call_mode::raw, body);
+        return call_future<two_way>(session, std::move(call), [](const std::vector<char>& ret)
+        {
+            return two_way(ret.begin(), ret.end());
+        });
+    }
+
+private:
+    struct key_extractor_base
+    {
+        virtual ~key_extractor_base() = default;
+    };
+
+    template<typename Function>
+    struct key_extractor;
+
+    template<typename Return, typename... Args>
+    struct key_extractor<Return(Args...)> : public key_extractor_base
+    {
+        std::function<std::string(const typename std::decay<Args>::type&...)> func;
+    };
+
+    template<typename Protocol, typename... Args>
+    rpc_session& pick_session(const Protocol& protocol, const Args&... args)
+    {
+        if (key_extractors_.empty())
+        {
+            return balancer_.pick();
+        }
+
+        auto iter = key_extractors_.find(protocol.name());
+        if (iter == key_extractors_.end())
+        {
+            return balancer_.pick();
+        }
+
+        auto extractor = dynamic_cast<key_extractor<typename Protocol::function_type>*>(iter->second.get());
+        if (extractor == nullptr)
+        {
+            throw std::invalid_argument("Key extractor does not match protocol: " + protocol.name());
+        }
+        return balancer_.pick(extractor->func(args...));
+    }
+
+    // 应答已到达(或出错)的调用从notify得知，先等到的那个生效.
+    struct completion_signal
+    {
+        std::mutex mutex;
+        std::condition_variable cond;
+
+        void notify()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            cond.notify_all();
+        }
+    };
+
+    static bool is_ready(const pending_call& call)
+    {
+        return call.future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
+
+    std::vector<char> hedged_call(rpc_session& session, const std::string& protocol, call_mode mode, const std::string& body)
+    {
+        retry_budget_.deposit();
+        auto signal = std::make_shared<completion_signal>();
+        auto notify = [signal]{ signal->notify(); };
+        pending_call primary = session.async_call(protocol, mode, body, notify);
+
+        // 样本太少时分位数不可信，不对冲.
+        const windowed_histogram& latency = session.latency_histogram();
+        if (latency.count() < min_hedge_samples)
+        {
+            return session.wait(primary);
+        }
+
+        auto hedge_delay = std::chrono::microseconds(latency.percentile(hedge_percentile_));
+        auto hedge_time = std::min(pending_call::clock_type::now() + hedge_delay, primary.deadline);
+        if (primary.future.wait_until(hedge_time) == std::future_status::ready || !retry_budget_.withdraw())
+        {
+            return session.wait(primary);
+        }
+
+        rpc_session* other = balancer_.pick_other(session);
+        if (other == nullptr)
+        {
+            return session.wait(primary);
+        }
+
+        pending_call backup;
+        try
+        {
+            backup = other->async_call(protocol, mode, body, notify);
+        }
+        catch (std::exception&)
+        {
+            return session.wait(primary);
+        }
+
+        // 整个调用以主调用的截止时间为准，对冲不延长超时.
+        backup.deadline = std::min(backup.deadline, primary.deadline);
+        bool is_any_ready = false;
+        {
+            std::unique_lock<std::mutex> lock(signal->mutex);
+            auto pred = [&]{ return is_ready(primary) || is_ready(backup); };
+            if (primary.deadline == pending_call::clock_type::time_point::max())
+            {
+                signal->cond.wait(lock, pred);
+                is_any_ready = true;
+            }
+            else
+            {
+                is_any_ready = signal->cond.wait_until(lock, primary.deadline, pred);
+            }
+        }
+
+        if (!is_any_ready)
+        {
+            session.cancel(primary.request_id);
+            other->cancel(backup.request_id);
+            metrics_.add_timeout();
+            throw std::runtime_error("Timeout");
+        }
+
+        bool primary_first = is_ready(primary) || !is_ready(backup);
+        rpc_session& winner_session = primary_first ? session : *other;
+        rpc_session& loser_session = primary_first ? *other : session;
+        pending_call& winner = primary_first ? primary : backup;
+        pending_call& loser = primary_first ? backup : primary;
+        try
+        {
+            auto ret = winner_session.wait(winner);
+            loser_session.cancel(loser.request_id);
+            return ret;
+        }
+        catch (rpc_error&)
+        {
+            loser_session.cancel(loser.request_id);
+            throw;
+        }
+        catch (std::exception&)
+        {
+            // 先结束的一方是网络错误，结果以另一方为准，最多等到主调用的截止时间.
+            return loser_session.wait(loser);
+        }
+    }
+
+    std::unique_ptr<rpc_session> make_session(const std::string& address)
+    {
+        auto session = std::make_unique<rpc_session>();
+        session->timeout(timeout_milli_);
+        session->set_priority(priority_);
+        session->set_metrics(metrics_);
+        session->batch_one_way(max_batch_bytes_, max_batch_delay_micro_);
+        session->busy_poll(spin_micro_, socket_busy_poll_micro_);
+        if (string_util::starts_with(address, unix_prefix))
+        {
+            std::string path = address.substr(unix_prefix.size());
+            if (path.empty())
+            {
+                throw std::invalid_argument("Address format error");
+            }
+            session->connect_local(path);
+            return session;
+        }
+
+        if (string_util::starts_with(address, shm_prefix))
+        {
+            session->connect_shm(address);
+            return session;
+        }
+
+        std::vector<std::string> token = string_util::split(address, ":");
+        if (token.size() != 2)
+        {
+            throw std::invalid_argument("Address format error");
+        }
+        session->connect(token[0], token[1]);
+        return session;
+    }
+
+    // 读取到buf后不进行任何处理，等待server端确认请求已处理.
+    template<typename Protocol>
+    typename std::enable_if<std::is_void<typename Protocol::return_type>::value, 
+                            typename call_future<void>::decoder_t>::type
+    make_decoder(const Protocol&)
+    {
+        return [](const std::vector<char>&){};
+    }
+
+    template<typename Protocol>
+    typename std::enable_if<!std::is_void<typename Protocol::return_type>::value, 
+                            typename call_future<typename Protocol::return_type>::decoder_t>::type
+    make_decoder(const Protocol& protocol)
+    {
+        auto metrics = &metrics_.protocol(protocol.name());
+        return [protocol, metrics](const std::vector<char>& ret)
+        {
+            auto begin_time = std::chrono::steady_clock::now();
+            auto value = protocol.unpack(std::string(ret.begin(), ret.end()));
+            auto micro = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin_time).count();
+            metrics->decode_micro.record(static_cast<std::uint64_t>(micro));
+            return value;
+        };
     }
 
 private:
-    rpc_session session_;
-    std::mutex mutex_;
+    static const std::uint64_t min_hedge_samples = 20;
+    client_metrics metrics_;
+    load_balancer balancer_;
+    double hedge_percentile_ = 0;
+    easyrpc::retry_budget retry_budget_;
+    result_cache cache_;
+    std::unordered_map<std::string, std::shared_ptr<key_extractor_base>> key_extractors_;
+    std::size_t timeout_milli_ = 0;
+    std::size_t max_batch_bytes_ = 0;
+    std::size_t max_batch_delay_micro_ = 0;
+    std::size_t spin_micro_ = 0;
+    std::size_t socket_busy_poll_micro_ = 0;
+    easyrpc::priority priority_ = easyrpc::priority::unspecified;
 };
 
 }
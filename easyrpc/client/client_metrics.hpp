@@ -0,0 +1,136 @@
+#ifndef _CLIENT_METRICS_H
+#define _CLIENT_METRICS_H
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+#include "base/histogram.hpp"
+
+namespace easyrpc
+{
+
+// 客户端各阶段的耗时(微秒)和计数，client的所有连接共用一份，用于区分网络时间和服务端时间.
+class client_metrics
+{
+public:
+    struct protocol_metrics
+    {
+        histogram write_micro;      // 发起调用到请求写入socket，包括等待前面的数据写完
+        histogram wait_micro;       // 发出请求到收到应答
+        histogram decode_micro;     // 解码应答
+    };
+
+    client_metrics() = default;
+    client_metrics(const client_metrics&) = delete;
+    client_metrics& operator=(const client_metrics&) = delete;
+
+    // 第一次调用该协议时创建，之后返回的引用一直有效.
+    protocol_metrics& protocol(const std::string& name)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& ptr = protocol_map_[name];
+        if (ptr == nullptr)
+        {
+            ptr = std::make_unique<protocol_metrics>();
+        }
+        return *ptr;
+    }
+
+    // 没有调用过该协议时返回nullptr.
+    const protocol_metrics* find(const std::string& name) const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto iter = protocol_map_.find(name);
+        return iter == protocol_map_.end() ? nullptr : iter->second.get();
+    }
+
+    std::vector<std::string> protocols() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<std::string> names;
+        for (auto& iter : protocol_map_)
+        {
+            names.emplace_back(iter.first);
+        }
+        return names;
+    }
+
+    histogram& connect_micro()
+    {
+        return connect_micro_;
+    }
+
+    const histogram& connect_micro() const
+    {
+        return connect_micro_;
+    }
+
+    void add_reconnect()
+    {
+        reconnects_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void add_timeout()
+    {
+        timeouts_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // 连接断开后没有机会再写出、被丢弃的单向调用.
+    void add_dropped_one_way(std::uint64_t count)
+    {
+        dropped_one_way_.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    void add_bytes_sent(std::uint64_t bytes)
+    {
+        bytes_sent_.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    void add_bytes_received(std::uint64_t bytes)
+    {
+        bytes_received_.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    std::uint64_t reconnects() const
+    {
+        return reconnects_.load(std::memory_order_relaxed);
+    }
+
+    std::uint64_t timeouts() const
+    {
+        return timeouts_.load(std::memory_order_relaxed);
+    }
+
+    std::uint64_t dropped_one_way() const
+    {
+        return dropped_one_way_.load(std::memory_order_relaxed);
+    }
+
+    std::uint64_t bytes_sent() const
+    {
+        return bytes_sent_.load(std::memory_order_relaxed);
+    }
+
+    std::uint64_t bytes_received() const
+    {
+        return bytes_received_.load(std::memory_order_relaxed);
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, std::unique_ptr<protocol_metrics>> protocol_map_;
+    histogram connect_micro_;
+    std::atomic<std::uint64_t> reconnects_{ 0 };
+    std::atomic<std::uint64_t> timeouts_{ 0 };
+    std::atomic<std::uint64_t> dropped_one_way_{ 0 };
+    std::atomic<std::uint64_t> bytes_sent_{ 0 };
+    std::atomic<std::uint64_t> bytes_received_{ 0 };
+};
+
+}
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef _HASH_RING_H
+#define _HASH_RING_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <type_traits>
+
+namespace easyrpc
+{
+
+// 一致性哈希环，每个server放置多个虚拟节点，增删server时只有相邻区间的key换到别的server上.
+class hash_ring
+{
+public:
+    static const std::size_t default_virtual_nodes = 160;
+
+    void clear()
+    {
+        nodes_.clear();
+    }
+
+    void add(const std::string& name, std::size_t index, std::size_t virtual_nodes = default_virtual_nodes)
+    {
+        for (std::size_t i = 0; i < virtual_nodes; ++i)
+        {
+            nodes_.emplace_back(hash(name + "#" + std::to_string(i)), index);
+        }
+        std::sort(nodes_.begin(), nodes_.end());
+    }
+
+    bool empty() const
+    {
+        return nodes_.empty();
+    }
+
+    // 从key的位置顺时针找第一个被accept接受的server，都不接受时返回key所在位置的server.
+    template<typename Predicate>
+    std::size_t locate(const std::string& key, const Predicate& accept) const
+    {
+        auto begin = std::lower_bound(nodes_.begin(), nodes_.end(), std::make_pair(hash(key), std::size_t(0)));
+        std::size_t start = static_cast<std::size_t>(begin - nodes_.begin()) % nodes_.size();
+        for (std::size_t i = 0; i < nodes_.size(); ++i)
+        {
+            std::size_t index = nodes_[(start + i) % nodes_.size()].second;
+            if (accept(index))
+            {
+                return index;
+            }
+        }
+        return nodes_[start].second;
+    }
+
+    // FNV-1a再加上murmur3的fmix64，与进程和平台无关，多个client对同一个key得到相同的server.
+    static std::uint64_t hash(const std::string& key)
+    {
+        std::uint64_t h = 14695981039346656037ULL;
+        for (unsigned char c : key)
+        {
+            h ^= c;
+            h *= 1099511628211ULL;
+        }
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+private:
+    std::vector<std::pair<std::uint64_t, std::size_t>> nodes_;
+};
+
+inline std::string to_hash_key(const std::string& key)
+{
+    return key;
+}
+
+inline std::string to_hash_key(const char* key)
+{
+    return key;
+}
+
+template<typename T>
+typename std::enable_if<std::is_arithmetic<T>::value, std::string>::type to_hash_key(T key)
+{
+    return std::to_string(key);
+}
+
+}
+
+#endif
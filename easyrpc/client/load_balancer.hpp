@@ -0,0 +1,257 @@
+#ifndef _LOAD_BALANCER_H
+#define _LOAD_BALANCER_H
+
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <random>
+#include <chrono>
+#include <condition_variable>
+#include "rpc_session.hpp"
+#include "hash_ring.hpp"
+
+namespace easyrpc
+{
+
+enum class balance_policy
+{
+    least_outstanding,      // 尚未应答的调用最少的server
+    power_of_two_choices    // 随机选两个，取(未应答数 + 1) * 平滑时延较小的那个
+};
+
+// 每个server一个长连接的rpc_session，按策略为每次调用选择一个；
+// 连续出现网络错误的server被摘除，由健康检查线程重连成功后再加回来.
+class load_balancer
+{
+public:
+    load_balancer() = default;
+    load_balancer(const load_balancer&) = delete;
+    load_balancer& operator=(const load_balancer&) = delete;
+
+    ~load_balancer()
+    {
+        stop();
+    }
+
+    void clear()
+    {
+        sessions_.clear();
+        ring_.clear();
+    }
+
+    void add(std::unique_ptr<rpc_session> session, const std::string& address)
+    {
+        ring_.add(address, sessions_.size());
+        sessions_.emplace_back(std::move(session));
+    }
+
+    const std::vector<std::unique_ptr<rpc_session>>& sessions() const
+    {
+        return sessions_;
+    }
+
+    void set_policy(balance_policy policy)
+    {
+        policy_ = policy;
+    }
+
+    void run()
+    {
+        for (auto& session : sessions_)
+        {
+            session->run();
+        }
+
+        if (sessions_.size() > 1)
+        {
+            is_stop_ = false;
+            health_check_thread_ = std::make_unique<std::thread>([this]{ health_check(); });
+        }
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            is_stop_ = true;
+        }
+        cond_.notify_all();
+        if (health_check_thread_ != nullptr && health_check_thread_->joinable())
+        {
+            health_check_thread_->join();
+        }
+        health_check_thread_.reset();
+
+        for (auto& session : sessions_)
+        {
+            session->stop();
+        }
+    }
+
+    // 所有server都被摘除时仍然在全部server中选择，让调用直接暴露出错误.
+    rpc_session& pick()
+    {
+        if (sessions_.empty())
+        {
+            throw std::runtime_error("No server address");
+        }
+
+        if (sessions_.size() == 1)
+        {
+            return *sessions_[0];
+        }
+
+        thread_local std::vector<std::size_t> candidates;
+        candidates.clear();
+        for (std::size_t i = 0; i < sessions_.size(); ++i)
+        {
+            if (is_healthy(*sessions_[i]))
+            {
+                candidates.emplace_back(i);
+            }
+        }
+
+        if (candidates.empty())
+        {
+            for (std::size_t i = 0; i < sessions_.size(); ++i)
+            {
+                candidates.emplace_back(i);
+            }
+        }
+
+        if (policy_ == balance_policy::power_of_two_choices)
+        {
+            return *sessions_[pick_two_choices(candidates)];
+        }
+        return *sessions_[pick_least_outstanding(candidates)];
+    }
+
+    // 按key在一致性哈希环上选择，同一个key总是落到同一个server上，该server被摘除时顺延到下一个.
+    rpc_session& pick(const std::string& key)
+    {
+        if (sessions_.empty())
+        {
+            throw std::runtime_error("No server address");
+        }
+
+        std::size_t index = ring_.locate(key, [this](std::size_t i){ return is_healthy(*sessions_[i]); });
+        return *sessions_[index];
+    }
+
+    // 对冲请求用：除exclude之外未应答调用最少的健康server，没有时返回nullptr.
+    rpc_session* pick_other(const rpc_session& exclude)
+    {
+        rpc_session* best = nullptr;
+        for (auto& session : sessions_)
+        {
+            if (session.get() == &exclude || !is_healthy(*session))
+            {
+                continue;
+            }
+
+            if (best == nullptr || session->outstanding() < best->outstanding())
+            {
+                best = session.get();
+            }
+        }
+        return best;
+    }
+
+private:
+    static bool is_healthy(const rpc_session& session)
+    {
+        return session.failures() < max_failures;
+    }
+
+    // 从轮转的起点开始找，未应答数相同时各server轮流被选中.
+    std::size_t pick_least_outstanding(const std::vector<std::size_t>& candidates)
+    {
+        std::size_t start = next_++;
+        std::size_t best = candidates[start % candidates.size()];
+        for (std::size_t i = 1; i < candidates.size(); ++i)
+        {
+            std::size_t index = candidates[(start + i) % candidates.size()];
+            if (sessions_[index]->outstanding() < sessions_[best]->outstanding())
+            {
+                best = index;
+            }
+        }
+        return best;
+    }
+
+    std::size_t pick_two_choices(const std::vector<std::size_t>& candidates)
+    {
+        thread_local std::minstd_rand engine(std::random_device{}());
+        if (candidates.size() == 1)
+        {
+            return candidates[0];
+        }
+
+        std::size_t first = engine() % candidates.size();
+        std::size_t second = engine() % (candidates.size() - 1);
+        if (second >= first)
+        {
+            ++second;
+        }
+
+        first = candidates[first];
+        second = candidates[second];
+        return load(*sessions_[first]) <= load(*sessions_[second]) ? first : second;
+    }
+
+    static double load(const rpc_session& session)
+    {
+        // 还没有时延数据的server视为最快，让它尽快得到样本.
+        return (session.outstanding() + 1) * session.latency_micro();
+    }
+
+    void health_check()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!is_stop_)
+        {
+            cond_.wait_for(lock, std::chrono::milliseconds(health_check_interval_milli));
+            if (is_stop_)
+            {
+                break;
+            }
+
+            lock.unlock();
+            for (auto& session : sessions_)
+            {
+                if (is_healthy(*session))
+                {
+                    continue;
+                }
+
+                try
+                {
+                    // 重新建立连接成功后failures清零，server自然重新加入.
+                    session->connect();
+                }
+                catch (std::exception&)
+                {
+                }
+            }
+            lock.lock();
+        }
+    }
+
+private:
+    static const std::size_t max_failures = 3;
+    static const std::size_t health_check_interval_milli = 1000;
+    std::vector<std::unique_ptr<rpc_session>> sessions_;
+    hash_ring ring_;
+    balance_policy policy_ = balance_policy::least_outstanding;
+    std::atomic<std::size_t> next_{ 0 };
+    std::unique_ptr<std::thread> health_check_thread_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool is_stop_ = false;
+};
+
+}
+
+#endif
@@ -18,6 +18,7 @@ template<typename Return, typename... Args>
 class protocol_define<Return(Args...)>
 {
 public:
+    using function_type = Return(Args...);
     using return_type = typename function_traits<Return(Args...)>::return_type;
     explicit protocol_define(std::string name) : name_(std::move(name)) {}
 
@@ -0,0 +1,191 @@
+#ifndef _RESULT_CACHE_H
+#define _RESULT_CACHE_H
+
+#include <list>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <unordered_map>
+
+namespace easyrpc
+{
+
+static const std::size_t default_cache_max_entries = 10000;
+
+// 按(协议名, 打包后的参数)缓存调用结果，每个协议单独开启并指定ttl，
+// 所有协议共用一个容量上限，满了以后淘汰最久未使用的结果；
+// 调用前取得协议的generation，调用期间该协议有结果失效时put丢弃这次的结果，避免把失效前的数据写回缓存.
+class result_cache
+{
+public:
+    using clock_type = std::chrono::steady_clock;
+
+    result_cache() = default;
+    result_cache(const result_cache&) = delete;
+    result_cache& operator=(const result_cache&) = delete;
+
+    static std::string make_key(const std::string& protocol, const std::string& body)
+    {
+        std::string key;
+        key.reserve(protocol.size() + body.size() + 1);
+        key.append(protocol);
+        key.push_back('\0');
+        key.append(body);
+        return key;
+    }
+
+    void enable(const std::string& protocol, std::size_t ttl_milli)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ttl_map_[protocol] = std::chrono::milliseconds(ttl_milli);
+        is_enabled_ = true;
+    }
+
+    void set_max_entries(std::size_t max_entries)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        max_entries_ = max_entries == 0 ? 1 : max_entries;
+        evict();
+    }
+
+    // 没有任何协议开启缓存时不加锁，不影响普通调用.
+    bool is_enabled(const std::string& protocol)
+    {
+        if (!is_enabled_)
+        {
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        return ttl_map_.find(protocol) != ttl_map_.end();
+    }
+
+    bool get(const std::string& key, std::vector<char>& value)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto iter = entry_map_.find(key);
+        if (iter == entry_map_.end())
+        {
+            return false;
+        }
+
+        if (clock_type::now() >= iter->second->expire_time)
+        {
+            lru_list_.erase(iter->second);
+            entry_map_.erase(iter);
+            return false;
+        }
+
+        lru_list_.splice(lru_list_.begin(), lru_list_, iter->second);
+        value = iter->second->value;
+        return true;
+    }
+
+    std::uint64_t generation(const std::string& protocol)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return generation_map_[protocol];
+    }
+
+    void put(const std::string& protocol, const std::string& key, const std::vector<char>& value, std::uint64_t generation)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto ttl_iter = ttl_map_.find(protocol);
+        if (ttl_iter == ttl_map_.end() || generation_map_[protocol] != generation)
+        {
+            return;
+        }
+
+        auto iter = entry_map_.find(key);
+        if (iter != entry_map_.end())
+        {
+            lru_list_.erase(iter->second);
+            entry_map_.erase(iter);
+        }
+
+        lru_list_.push_front({ key, protocol, value, clock_type::now() + ttl_iter->second });
+        entry_map_[key] = lru_list_.begin();
+        evict();
+    }
+
+    void invalidate(const std::string& key)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++generation_map_[key.substr(0, key.find('\0'))];
+        auto iter = entry_map_.find(key);
+        if (iter != entry_map_.end())
+        {
+            lru_list_.erase(iter->second);
+            entry_map_.erase(iter);
+        }
+    }
+
+    void invalidate_protocol(const std::string& protocol)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++generation_map_[protocol];
+        for (auto iter = lru_list_.begin(); iter != lru_list_.end();)
+        {
+            if (iter->protocol == protocol)
+            {
+                entry_map_.erase(iter->key);
+                iter = lru_list_.erase(iter);
+            }
+            else
+            {
+                ++iter;
+            }
+        }
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& pair : generation_map_)
+        {
+            ++pair.second;
+        }
+        lru_list_.clear();
+        entry_map_.clear();
+    }
+
+    std::size_t size()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return entry_map_.size();
+    }
+
+private:
+    struct entry
+    {
+        std::string key;
+        std::string protocol;
+        std::vector<char> value;
+        clock_type::time_point expire_time;
+    };
+
+    void evict()
+    {
+        while (entry_map_.size() > max_entries_)
+        {
+            entry_map_.erase(lru_list_.back().key);
+            lru_list_.pop_back();
+        }
+    }
+
+private:
+    std::mutex mutex_;
+    std::atomic<bool> is_enabled_{ false };
+    std::size_t max_entries_ = default_cache_max_entries;
+    std::unordered_map<std::string, std::chrono::milliseconds> ttl_map_;
+    std::unordered_map<std::string, std::uint64_t> generation_map_;
+    std::list<entry> lru_list_;
+    std::unordered_map<std::string, std::list<entry>::iterator> entry_map_;
+};
+
+}
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef _RETRY_BUDGET_H
+#define _RETRY_BUDGET_H
+
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+
+namespace easyrpc
+{
+
+// 令牌桶形式的重试预算：每个正常调用存入ratio个令牌，另外每秒补充min_per_second个，
+// 每次对冲或重试取走一个，桶满时不再增加；server整体故障时重试量不会超过正常调用量的ratio倍.
+class retry_budget
+{
+public:
+    using clock_type = std::chrono::steady_clock;
+
+    retry_budget(double ratio = 0.1, double min_per_second = 10, double max_tokens = 100)
+        : ratio_(ratio), min_per_second_(min_per_second), max_tokens_(max_tokens), tokens_(max_tokens),
+        last_refill_time_(clock_type::now()) {}
+
+    void set(double ratio, double min_per_second, double max_tokens)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ratio_ = ratio;
+        min_per_second_ = min_per_second;
+        max_tokens_ = max_tokens;
+        tokens_ = std::min(tokens_, max_tokens_);
+    }
+
+    void deposit()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        refill();
+        tokens_ = std::min(max_tokens_, tokens_ + ratio_);
+    }
+
+    bool withdraw()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        refill();
+        if (tokens_ < 1)
+        {
+            return false;
+        }
+        tokens_ -= 1;
+        return true;
+    }
+
+private:
+    void refill()
+    {
+        auto now = clock_type::now();
+        double seconds = std::chrono::duration<double>(now - last_refill_time_).count();
+        last_refill_time_ = now;
+        tokens_ = std::min(max_tokens_, tokens_ + seconds * min_per_second_);
+    }
+
+private:
+    std::mutex mutex_;
+    double ratio_;
+    double min_per_second_;
+    double max_tokens_;
+    double tokens_;
+    clock_type::time_point last_refill_time_;
+};
+
+}
+
+#endif
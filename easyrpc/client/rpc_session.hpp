@@ -5,21 +5,43 @@
 #include <vector>
 #include <thread>
 #include <memory>
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <chrono>
+#include <condition_variable>
+#include <unordered_map>
+#include "base/io_backend.hpp"
 #include <boost/asio.hpp>
 #include "base/header.hpp"
-#include "base/atimer.hpp"
-#include "base/scope_guard.hpp"
+#include "base/rpc_error.hpp"
+#include "base/request_context.hpp"
+#include "base/histogram.hpp"
+#include "base/tracer.hpp"
+#include "base/busy_poll.hpp"
+#include "shm_session.hpp"
+#include "client_metrics.hpp"
 
 namespace easyrpc
 {
 
+static const std::size_t disconnect_drain_milli = 1000;
+
+// 已发出、尚未取回结果的调用.
+struct pending_call
+{
+    using clock_type = std::chrono::steady_clock;
+    unsigned int request_id = 0;
+    clock_type::time_point deadline = clock_type::time_point::max();
+    std::future<std::vector<char>> future;
+};
+
 class rpc_session
 {
 public:
     rpc_session(const rpc_session&) = delete;
     rpc_session& operator=(const rpc_session&) = delete;
-    rpc_session() : work_(ios_), socket_(ios_), 
-    timer_work_(timer_ios_), timer_(timer_ios_) {}
+    rpc_session() : work_(ios_), batch_timer_(ios_) {}
 
     ~rpc_session()
     {
@@ -30,7 +52,30 @@ public:
     {
         boost::asio::ip::tcp::resolver resolver(ios_);
         boost::asio::ip::tcp::resolver::query query(boost::asio::ip::tcp::v4(), ip, port);
-        endpoint_iter_ = resolver.resolve(query);
+        endpoints_.clear();
+        for (auto iter = resolver.resolve(query); iter != boost::asio::ip::tcp::resolver::iterator(); ++iter)
+        {
+            endpoints_.emplace_back(iter->endpoint());
+        }
+    }
+
+    void connect_local(const std::string& path)
+    {
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+        endpoints_.clear();
+        endpoints_.emplace_back(boost::asio::local::stream_protocol::endpoint(path));
+#else
+        throw std::invalid_argument("Unix domain socket is not supported");
+#endif
+    }
+
+    void connect_shm(const std::string& address)
+    {
+#ifdef EASYRPC_HAS_SHM_TRANSPORT
+        shm_ = std::make_unique<shm_session>(shm_segment::make_name(address));
+#else
+        throw std::invalid_argument("Shared memory transport is not supported");
+#endif
     }
 
     void timeout(std::size_t timeout_milli)
@@ -38,177 +83,772 @@ public:
         timeout_milli_ = timeout_milli;
     }
 
+    // 此后的调用都带上该优先级，unspecified表示使用服务端为协议设置的默认优先级.
+    void set_priority(priority prio)
+    {
+        priority_ = prio;
+    }
+
+    // io线程和等待应答的调用方都先自旋spin_micro再睡眠，socket_busy_poll_micro不为0时设置SO_BUSY_POLL；需在run之前调用.
+    void busy_poll(std::size_t spin_micro, std::size_t socket_busy_poll_micro)
+    {
+        spin_micro_ = spin_micro;
+        socket_busy_poll_micro_ = socket_busy_poll_micro;
+    }
+
     void run()
     {
-        thread_ = std::make_unique<std::thread>([this]{ ios_.run(); });
-        if (timeout_milli_ != 0)
-        {
-            timer_thread_ = std::make_unique<std::thread>([this]{ timer_ios_.run(); });
-        }
+        std::size_t spin_micro = spin_micro_;
+        thread_ = std::make_unique<std::thread>([this, spin_micro]{ run_busy_poll(ios_, spin_micro); });
     }
 
     void stop()
     {
+        disconnect();
+        drop_batch();
         stop_ios_thread();
-        stop_timer_thread();
     }
 
     std::vector<char> call(const std::string& protocol, const call_mode& mode, const std::string& body)
     {
-        write(protocol, mode, body);
-        return read();
+        pending_call call = async_call(protocol, mode, body);
+        return wait(call);
+    }
+
+    // 单向调用：请求写出(或放入合并缓冲)后立即返回，服务端不应答，出错时调用方也无从得知；
+    // 合并缓冲中的请求在连接断开时保留，重连后写出，会话停止时仍未写出的计入metrics的dropped_one_way.
+    void send(const std::string& protocol, const call_mode& mode, const std::string& body)
+    {
+        request_header head{ static_cast<unsigned int>(protocol.size()), static_cast<unsigned int>(body.size()),
+                             mode, static_cast<unsigned int>(call_budget()), ++last_request_id_, priority_, flag_one_way, 
+                             make_trace_id() };
+        tracer::instance().record(head.trace_id, head.request_id, trace_point::client_send);
+#ifdef EASYRPC_HAS_SHM_TRANSPORT
+        if (shm_ != nullptr)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            shm_->send(head, protocol, body);
+            return;
+        }
+#endif
+        std::unique_lock<std::mutex> lock(mutex_);
+        wait_writable(lock);
+        connect_impl();
+        try
+        {
+            if (max_batch_bytes_ == 0)
+            {
+                write(head, protocol, body);
+                return;
+            }
+            append_batch(head, protocol, body);
+        }
+        catch (std::exception&)
+        {
+            ++failures_;
+            close_stream("Connection closed");
+            throw;
+        }
+    }
+
+    // 连续的单向调用先攒在缓冲里，满max_batch_bytes或者等待max_delay_micro后一次写出，
+    // 之后的双向调用会先把缓冲带上，顺序不变；max_batch_bytes为0时不合并.
+    void batch_one_way(std::size_t max_batch_bytes, std::size_t max_delay_micro)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        max_batch_bytes_ = max_batch_bytes;
+        max_batch_delay_micro_ = max_delay_micro;
+    }
+
+    void flush()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        flush_batch();
+    }
+
+    // 写出请求后立即返回，应答由io线程按request_id交给对应的future，同一连接上可以有多个调用同时进行；
+    // notify在future就绪(包括出错、取消)之后调用，用于同时等待多个调用.
+    pending_call async_call(const std::string& protocol, const call_mode& mode, const std::string& body, 
+                            const std::function<void()>& notify = nullptr)
+    {
+        std::size_t budget_milli = call_budget();
+        pending_call call;
+        call.request_id = ++last_request_id_;
+        if (budget_milli != 0)
+        {
+            call.deadline = pending_call::clock_type::now() + std::chrono::milliseconds(budget_milli);
+        }
+
+        request_header head{ static_cast<unsigned int>(protocol.size()), static_cast<unsigned int>(body.size()),
+                             mode, static_cast<unsigned int>(budget_milli), call.request_id, priority_, 0, make_trace_id() };
+        tracer::instance().record(head.trace_id, head.request_id, trace_point::client_send);
+        auto& protocol_metrics = metrics_->protocol(protocol);
+        std::promise<std::vector<char>> promise;
+        call.future = promise.get_future();
+#ifdef EASYRPC_HAS_SHM_TRANSPORT
+        if (shm_ != nullptr)
+        {
+            // 共享内存通道一次只承载一个调用，同步完成.
+            std::lock_guard<std::mutex> lock(mutex_);
+            try
+            {
+                auto begin_time = pending_call::clock_type::now();
+                promise.set_value(shm_->call(head, protocol, body));
+                auto latency = pending_call::clock_type::now() - begin_time;
+                update_latency(latency);
+                protocol_metrics.wait_micro.record(to_micro(latency));
+                tracer::instance().record(head.trace_id, head.request_id, trace_point::client_receive);
+            }
+            catch (...)
+            {
+                promise.set_exception(std::current_exception());
+            }
+
+            if (notify != nullptr)
+            {
+                notify();
+            }
+            return call;
+        }
+#endif
+        std::unique_lock<std::mutex> lock(mutex_);
+        wait_writable(lock);
+        connect_impl();
+        {
+            std::lock_guard<std::mutex> pending_lock(pending_mutex_);
+            pending_map_.emplace(call.request_id, pending_entry{ std::move(promise), pending_call::clock_type::now(), notify, head.trace_id, &protocol_metrics });
+            outstanding_ = pending_map_.size();
+        }
+
+        try
+        {
+            write(head, protocol, body, &protocol_metrics);
+        }
+        catch (std::exception&)
+        {
+            // 网络错误后断开，下次调用时重连.
+            ++failures_;
+            close_stream("Connection closed");
+            throw;
+        }
+        return call;
+    }
+
+    // 超过deadline时取消请求并抛出异常，连接继续复用.
+    std::vector<char> wait(pending_call& call)
+    {
+        spin_wait(call);
+        if (call.deadline != pending_call::clock_type::time_point::max()
+            && call.future.wait_until(call.deadline) == std::future_status::timeout)
+        {
+            metrics_->add_timeout();
+            cancel(call.request_id);
+            throw std::runtime_error("Timeout");
+        }
+        return call.future.get();
     }
 
+    // 尚未应答的调用以cancelled_error结束，并通知服务端不再执行或者由handler自行停止.
+    void cancel(unsigned int request_id)
+    {
+        {
+            std::lock_guard<std::mutex> lock(pending_mutex_);
+            auto iter = pending_map_.find(request_id);
+            if (iter == pending_map_.end())
+            {
+                return;
+            }
+            iter->second.promise.set_exception(std::make_exception_ptr(cancelled_error("Cancelled")));
+            if (iter->second.notify != nullptr)
+            {
+                iter->second.notify();
+            }
+            pending_map_.erase(iter);
+            outstanding_ = pending_map_.size();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stream_ == nullptr)
+        {
+            return;
+        }
+
+        try
+        {
+            write(request_header{ 0, 0, call_mode::cancel, 0, request_id, priority::unspecified, 0 }, "", "");
+        }
+        catch (std::exception&)
+        {
+            close_stream("Connection closed");
+        }
+    }
+
+    // 长连接，已连接时什么也不做.
     void connect()
     {
-        boost::asio::connect(socket_, endpoint_iter_);
+#ifdef EASYRPC_HAS_SHM_TRANSPORT
+        if (shm_ != nullptr)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            shm_->connect();
+            return;
+        }
+#endif
+        std::lock_guard<std::mutex> lock(mutex_);
+        connect_impl();
+    }
+
+    // 负载均衡用：尚未应答的调用数、平滑后的调用时延和连续的网络错误次数.
+    std::size_t outstanding() const
+    {
+        return outstanding_;
+    }
+
+    double latency_micro() const
+    {
+        return latency_micro_;
+    }
+
+    // 只包含最近10~20秒的调用，对冲时机随当前时延变化.
+    const windowed_histogram& latency_histogram() const
+    {
+        return latency_histogram_;
+    }
+
+    std::size_t failures() const
+    {
+        return failures_;
+    }
+
+    // 默认每个会话一份，client让它的所有会话共用一份.
+    void set_metrics(client_metrics& metrics)
+    {
+        metrics_ = &metrics;
+    }
+
+    const client_metrics& metrics() const
+    {
+        return *metrics_;
     }
 
     void disconnect()
     {
-        if (socket_.is_open())
+#ifdef EASYRPC_HAS_SHM_TRANSPORT
+        if (shm_ != nullptr)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            shm_->disconnect();
+            return;
+        }
+#endif
+        std::unique_lock<std::mutex> lock(mutex_);
+        flush_batch();
+        // 攒着的请求(主要是单向调用)写完再断开，io线程没有运行时最多等待disconnect_drain_milli.
+        if (!ios_.get_executor().running_in_this_thread())
         {
-            boost::system::error_code ignore_ec;
-            socket_.shutdown(boost::asio::socket_base::shutdown_both, ignore_ec);
-            socket_.close(ignore_ec);
+            write_drained_.wait_for(lock, std::chrono::milliseconds(disconnect_drain_milli), [this]
+            {
+                return stream_ == nullptr || (!stream_->is_writing && stream_->pending.empty());
+            });
         }
+        close_stream("Connection closed");
     }
 
 private:
-    void write(const std::string& protocol, const call_mode& mode, const std::string& body)
+    // 双向调用在写出缓冲中的位置，写完后记录从发起到写入socket的时间.
+    struct queued_write
     {
-        unsigned int protocol_len = static_cast<unsigned int>(protocol.size());
-        unsigned int body_len = static_cast<unsigned int>(body.size());
-        if (protocol_len + body_len > max_buffer_len)
+        client_metrics::protocol_metrics* metrics;
+        pending_call::clock_type::time_point begin_time;
+    };
+
+    // 每次连接对应一个stream，io线程上的读循环只持有自己的stream，重连后旧的读循环自然结束.
+    struct stream
+    {
+        explicit stream(boost::asio::io_service& ios) : socket(ios) {}
+        boost::asio::generic::stream_protocol::socket socket;
+        char head[response_header_len];
+        std::vector<char> body;
+        std::string pending;        // 正在写出时到达的请求
+        std::string writing;
+        std::vector<queued_write> pending_writes;
+        std::vector<queued_write> writing_writes;
+        bool is_writing = false;
+    };
+    using stream_ptr = std::shared_ptr<stream>;
+
+    struct pending_entry
+    {
+        std::promise<std::vector<char>> promise;
+        pending_call::clock_type::time_point send_time;
+        std::function<void()> notify;
+        unsigned int trace_id = 0;
+        client_metrics::protocol_metrics* metrics = nullptr;
+    };
+
+    // 在handler内发起的调用沿用上游请求的trace_id，整条调用链在trace中排在同一行.
+    static unsigned int make_trace_id()
+    {
+        tracer& t = tracer::instance();
+        if (!t.is_enabled())
         {
-            throw std::runtime_error("Send data is too big");
+            return 0;
+        }
+
+        const request_context* ctx = request_context::current();
+        if (ctx != nullptr && ctx->trace_id() != 0)
+        {
+            return ctx->trace_id();
+        }
+        return t.next_trace_id();
+    }
+
+    // 在handler内发起调用时，预算不超过上游请求剩余的时间.
+    std::size_t call_budget() const
+    {
+        std::size_t budget_milli = timeout_milli_;
+        if (this_request::has_deadline())
+        {
+            std::size_t remaining = this_request::remaining_milli();
+            if (remaining == 0)
+            {
+                throw deadline_exceeded_error("Deadline exceeded");
+            }
+            budget_milli = budget_milli == 0 ? remaining : std::min(budget_milli, remaining);
         }
+        return budget_milli;
+    }
 
-        const auto& buffer = get_buffer(request_header{ protocol_len, body_len, mode }, protocol, body);
-        write_impl(buffer);
+    // 应答通常在几十微秒内到达，先自旋避免调用线程睡眠后再被唤醒.
+    void spin_wait(pending_call& call)
+    {
+        if (spin_micro_ == 0)
+        {
+            return;
+        }
+
+        auto deadline = std::min(pending_call::clock_type::now() + std::chrono::microseconds(spin_micro_), call.deadline);
+        while (pending_call::clock_type::now() < deadline)
+        {
+            if (call.future.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+            {
+                return;
+            }
+        }
     }
 
-    std::vector<boost::asio::const_buffer> get_buffer(const request_header& head, 
-                                                      const std::string& protocol, 
-                                                      const std::string& body)
+    // 调用方需持有mutex_.
+    void connect_impl()
     {
-        std::vector<boost::asio::const_buffer> buffer;
-        buffer.emplace_back(boost::asio::buffer(&head, sizeof(request_header)));
-        buffer.emplace_back(boost::asio::buffer(protocol));
-        buffer.emplace_back(boost::asio::buffer(body));
-        return buffer;
+        if (stream_ != nullptr)
+        {
+            return;
+        }
+
+        auto s = std::make_shared<stream>(ios_);
+        auto begin_time = pending_call::clock_type::now();
+        try
+        {
+            boost::asio::connect(s->socket, endpoints_);
+            set_busy_poll(s->socket, socket_busy_poll_micro_);
+        }
+        catch (std::exception&)
+        {
+            ++failures_;
+            throw;
+        }
+        metrics_->connect_micro().record(to_micro(pending_call::clock_type::now() - begin_time));
+        if (has_connected_)
+        {
+            metrics_->add_reconnect();
+        }
+        has_connected_ = true;
+        stream_ = s;
+        failures_ = 0;
+        ios_.post([this, s]{ read_head(s); });
+        flush_batch();
     }
 
-    void write_impl(const std::vector<boost::asio::const_buffer>& buffer)
+    // 调用方需持有mutex_；socket只在io线程上操作，不与io线程上的读写并发.
+    void close_stream(const std::string& reason)
     {
-        boost::system::error_code ec;
-        boost::asio::write(socket_, buffer, ec);
-        if (ec)
+        if (stream_ != nullptr)
         {
-            throw std::runtime_error(ec.message());
+            stream_ptr s = stream_;
+            run_on_io_thread([s]
+            {
+                boost::system::error_code ignore_ec;
+                s->socket.shutdown(boost::asio::socket_base::shutdown_both, ignore_ec);
+                s->socket.close(ignore_ec);
+            });
+            stream_.reset();
         }
+        // 合并缓冲中的单向调用还没有交给socket，留到重连后写出，不会重复.
+        write_drained_.notify_all();
+        fail_all(reason);
     }
 
-    std::vector<char> read()
+    // 调用方需持有mutex_；没有正在写出的数据时立即发起写操作，否则追加到pending，
+    // 上一次写完后连同其他线程的请求一起写出，多个请求只需要一次系统调用；metrics不为空时在写完后记录write_micro.
+    void write(const request_header& head, const std::string& protocol, const std::string& body,
+               client_metrics::protocol_metrics* metrics = nullptr)
     {
-        start_timer();
-        auto guard = make_guard([this]{ stop_timer(); });
-        read_head();
-        check_head();
-        return read_body();
+        if (head.protocol_len + head.body_len > max_buffer_len)
+        {
+            throw std::runtime_error("Send data is too big");
+        }
+
+        std::string& pending = stream_->pending;
+        pending.append(batch_buffer_);
+        batch_buffer_.clear();
+        batch_count_ = 0;
+        pending.append(reinterpret_cast<const char*>(&head), sizeof(request_header));
+        pending.append(protocol);
+        pending.append(body);
+        if (metrics != nullptr)
+        {
+            stream_->pending_writes.push_back(queued_write{ metrics, pending_call::clock_type::now() });
+        }
+        if (!stream_->is_writing)
+        {
+            start_flush(stream_);
+        }
     }
 
-    void read_head()
+    // 调用方需持有mutex_；服务端不读取时调用方在这里等待，io线程上不能等待.
+    void wait_writable(std::unique_lock<std::mutex>& lock)
     {
-        boost::system::error_code ec;
-        boost::asio::read(socket_, boost::asio::buffer(head_), ec);
-        if (ec)
+        if (ios_.get_executor().running_in_this_thread())
         {
-            throw std::runtime_error(ec.message());
+            return;
         }
+
+        write_drained_.wait(lock, [this]
+        {
+            return stream_ == nullptr || stream_->pending.size() < static_cast<std::size_t>(max_pending_write_len);
+        });
     }
 
-    void check_head()
+    // 调用方需持有mutex_；在io线程上发起写操作，避免与读循环并发操作同一个socket.
+    void start_flush(const stream_ptr& s)
     {
-        memcpy(&res_head_, head_, sizeof(head_));
-        if (res_head_.body_len > max_buffer_len)
+        s->is_writing = true;
+        if (ios_.get_executor().running_in_this_thread())
         {
-            throw std::runtime_error("Body len is too big");
+            flush_stream(s);
+            return;
         }
+
+        ios_.post([this, s]
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            flush_stream(s);
+        });
     }
 
-    std::vector<char> read_body()
+    // 在io线程上执行，调用方需持有mutex_；写完的回调接着写出写出期间攒下的请求.
+    void flush_stream(const stream_ptr& s)
     {
-        body_.clear();
-        body_.resize(res_head_.body_len);
-        boost::system::error_code ec;
-        boost::asio::read(socket_, boost::asio::buffer(body_), ec); 
-        if (ec)
+        if (stream_ != s)
         {
-            throw std::runtime_error(ec.message());
+            // 连接已经关闭.
+            s->is_writing = false;
+            s->pending.clear();
+            s->pending_writes.clear();
+            write_drained_.notify_all();
+            return;
         }
-        return body_;
+
+        s->writing.swap(s->pending);
+        s->pending.clear();
+        s->writing_writes.swap(s->pending_writes);
+        s->pending_writes.clear();
+        s->is_writing = true;
+        boost::asio::async_write(s->socket, boost::asio::buffer(s->writing), 
+                                 [this, s](boost::system::error_code ec, std::size_t bytes)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            metrics_->add_bytes_sent(bytes);
+            s->is_writing = false;
+            s->writing.clear();
+            if (!ec)
+            {
+                auto now = pending_call::clock_type::now();
+                for (auto& w : s->writing_writes)
+                {
+                    w.metrics->write_micro.record(to_micro(now - w.begin_time));
+                }
+            }
+            s->writing_writes.clear();
+            if (ec)
+            {
+                if (stream_ == s)
+                {
+                    ++failures_;
+                    close_stream(ec.message());
+                }
+                return;
+            }
+
+            if (!s->pending.empty())
+            {
+                flush_stream(s);
+            }
+            write_drained_.notify_all();
+        });
     }
 
-    void start_timer()
+    // 调用方需持有mutex_.
+    void append_batch(const request_header& head, const std::string& protocol, const std::string& body)
     {
-        if (timeout_milli_ == 0)
+        if (head.protocol_len + head.body_len > max_buffer_len)
+        {
+            throw std::runtime_error("Send data is too big");
+        }
+
+        bool is_first = batch_buffer_.empty();
+        ++batch_count_;
+        batch_buffer_.append(reinterpret_cast<const char*>(&head), sizeof(request_header));
+        batch_buffer_.append(protocol);
+        batch_buffer_.append(body);
+        if (batch_buffer_.size() >= max_batch_bytes_)
         {
+            flush_batch();
             return;
         }
 
-        timer_.bind([this]{ disconnect(); });
-        timer_.set_single_shot(true);
-        timer_.start(timeout_milli_);
+        // 期间连接断开时缓冲留给重连后的连接，由connect_impl写出.
+        if (is_first)
+        {
+            batch_timer_.expires_from_now(std::chrono::microseconds(max_batch_delay_micro_));
+            batch_timer_.async_wait([this](const boost::system::error_code& ec)
+            {
+                if (ec)
+                {
+                    return;
+                }
+
+                std::lock_guard<std::mutex> lock(mutex_);
+                flush_batch();
+            });
+        }
+    }
+
+    void drop_batch()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (batch_count_ != 0)
+        {
+            metrics_->add_dropped_one_way(batch_count_);
+            batch_buffer_.clear();
+            batch_count_ = 0;
+        }
     }
 
-    void stop_timer()
+    // 调用方需持有mutex_.
+    void flush_batch()
     {
-        if (timeout_milli_ == 0)
+        if (batch_buffer_.empty() || stream_ == nullptr)
         {
             return;
         }
-        timer_.stop();
+
+        stream_->pending.append(batch_buffer_);
+        batch_buffer_.clear();
+        batch_count_ = 0;
+        if (!stream_->is_writing)
+        {
+            start_flush(stream_);
+        }
     }
 
-    void stop_ios_thread()
+    void read_head(const stream_ptr& s)
     {
-        ios_.stop();
-        if (thread_ != nullptr)
+        boost::asio::async_read(s->socket, boost::asio::buffer(s->head),
+                                [this, s](boost::system::error_code ec, std::size_t)
         {
-            if (thread_->joinable())
+            if (ec)
             {
-                thread_->join();
+                read_error(s, ec.message());
+                return;
             }
+
+            response_header res_head;
+            memcpy(&res_head, s->head, sizeof(s->head));
+            if (res_head.body_len > max_buffer_len)
+            {
+                read_error(s, "Body len is too big");
+                return;
+            }
+            read_body(s, res_head);
+        });
+    }
+
+    void read_body(const stream_ptr& s, const response_header& res_head)
+    {
+        s->body.resize(res_head.body_len);
+        boost::asio::async_read(s->socket, boost::asio::buffer(s->body),
+                                [this, s, res_head](boost::system::error_code ec, std::size_t)
+        {
+            if (ec)
+            {
+                read_error(s, ec.message());
+                return;
+            }
+
+            metrics_->add_bytes_received(response_header_len + res_head.body_len);
+            complete(res_head, std::move(s->body));
+            read_head(s);
+        });
+    }
+
+    void read_error(const stream_ptr& s, const std::string& reason)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stream_ == s)
+        {
+            ++failures_;
+            close_stream(reason);
         }
     }
 
-    void stop_timer_thread()
+    // 已超时或者已取消的调用不在pending_map_中，迟到的应答直接丢弃.
+    void complete(const response_header& res_head, std::vector<char> body)
     {
-        timer_ios_.stop();
-        if (timer_thread_ != nullptr)
+        pending_entry entry;
         {
-            if (timer_thread_->joinable())
+            std::lock_guard<std::mutex> lock(pending_mutex_);
+            auto iter = pending_map_.find(res_head.request_id);
+            if (iter == pending_map_.end())
             {
-                timer_thread_->join();
+                return;
+            }
+            entry = std::move(iter->second);
+            pending_map_.erase(iter);
+            outstanding_ = pending_map_.size();
+        }
+
+        auto latency = pending_call::clock_type::now() - entry.send_time;
+        update_latency(latency);
+        if (entry.metrics != nullptr)
+        {
+            entry.metrics->wait_micro.record(to_micro(latency));
+        }
+        tracer::instance().record(entry.trace_id, res_head.request_id, trace_point::client_receive);
+        if (res_head.status == rpc_status::ok)
+        {
+            entry.promise.set_value(std::move(body));
+        }
+        else
+        {
+            try
+            {
+                throw_rpc_error(res_head.status, std::string(body.begin(), body.end()));
+            }
+            catch (...)
+            {
+                entry.promise.set_exception(std::current_exception());
+            }
+        }
+
+        if (entry.notify != nullptr)
+        {
+            entry.notify();
+        }
+    }
+
+    void fail_all(const std::string& reason)
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        for (auto& iter : pending_map_)
+        {
+            iter.second.promise.set_exception(std::make_exception_ptr(std::runtime_error(reason)));
+            if (iter.second.notify != nullptr)
+            {
+                iter.second.notify();
+            }
+        }
+        pending_map_.clear();
+        outstanding_ = 0;
+    }
+
+    static std::uint64_t to_micro(pending_call::clock_type::duration duration)
+    {
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+    }
+
+    void update_latency(pending_call::clock_type::duration latency)
+    {
+        auto count = to_micro(latency);
+        latency_histogram_.record(count);
+        double micro = static_cast<double>(count);
+        double last = latency_micro_;
+        latency_micro_ = last == 0 ? micro : last + (micro - last) * latency_smoothing;
+    }
+
+    // 在io线程上执行，io线程没有运行时直接执行.
+    template<typename Handler>
+    void run_on_io_thread(Handler&& handler)
+    {
+        if (thread_ == nullptr || ios_.get_executor().running_in_this_thread())
+        {
+            handler();
+            return;
+        }
+        ios_.post(std::forward<Handler>(handler));
+    }
+
+    void stop_ios_thread()
+    {
+        // 之前投递的关闭连接等操作执行完再停止.
+        if (thread_ != nullptr)
+        {
+            ios_.post([this]{ ios_.stop(); });
+        }
+        else
+        {
+            ios_.stop();
+        }
+        if (thread_ != nullptr)
+        {
+            if (thread_->joinable())
+            {
+                thread_->join();
             }
         }
     }
 
 private:
+    static constexpr double latency_smoothing = 0.2;
     boost::asio::io_service ios_;
     boost::asio::io_service::work work_;
-    boost::asio::ip::tcp::socket socket_;
-    boost::asio::ip::tcp::resolver::iterator endpoint_iter_;
+    boost::asio::steady_timer batch_timer_;
+    std::string batch_buffer_;
+    std::size_t batch_count_ = 0;
+    std::size_t max_batch_bytes_ = 0;
+    std::size_t max_batch_delay_micro_ = 0;
+    std::vector<boost::asio::generic::stream_protocol::endpoint> endpoints_;
     std::unique_ptr<std::thread> thread_;
-    char head_[response_header_len];
-    response_header res_head_;
-    std::vector<char> body_;
-    boost::asio::io_service timer_ios_;
-    boost::asio::io_service::work timer_work_;
-    std::unique_ptr<std::thread> timer_thread_;
-    atimer<> timer_;
     std::size_t timeout_milli_ = 0;
+    std::size_t spin_micro_ = 0;
+    std::size_t socket_busy_poll_micro_ = 0;
+    std::atomic<priority> priority_{ priority::unspecified };
+    std::mutex mutex_;
+    std::condition_variable write_drained_;
+    stream_ptr stream_;
+    std::atomic<unsigned int> last_request_id_{ 0 };
+    std::mutex pending_mutex_;
+    std::unordered_map<unsigned int, pending_entry> pending_map_;
+    std::atomic<std::size_t> outstanding_{ 0 };
+    std::atomic<double> latency_micro_{ 0 };
+    windowed_histogram latency_histogram_;
+    std::atomic<std::size_t> failures_{ 0 };
+    bool has_connected_ = false;
+    client_metrics own_metrics_;
+    client_metrics* metrics_ = &own_metrics_;
+#ifdef EASYRPC_HAS_SHM_TRANSPORT
+    std::unique_ptr<shm_session> shm_;
+#endif
 };
 
 }
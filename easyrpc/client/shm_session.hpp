@@ -0,0 +1,187 @@
+#ifndef _SHM_SESSION_H
+#define _SHM_SESSION_H
+
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include "base/header.hpp"
+#include "base/shm_ring.hpp"
+#include "base/rpc_error.hpp"
+
+#ifdef EASYRPC_HAS_SHM_TRANSPORT
+
+namespace easyrpc
+{
+
+class shm_session
+{
+public:
+    shm_session(const shm_session&) = delete;
+    shm_session& operator=(const shm_session&) = delete;
+    shm_session(const std::string& name) : segment_(name, false) {}
+
+    ~shm_session()
+    {
+        release();
+    }
+
+    std::vector<char> call(const request_header& head, const std::string& protocol, const std::string& body)
+    {
+        connect();
+        write(head, protocol, body);
+        return read(head.request_id, head.budget_milli);
+    }
+
+    void send(const request_header& head, const std::string& protocol, const std::string& body)
+    {
+        connect();
+        write(head, protocol, body);
+    }
+
+    // 通道在会话期间一直占用，只有被服务端断开后才重新申请.
+    void connect()
+    {
+        if (channel_ != nullptr)
+        {
+            return;
+        }
+
+        for (std::size_t i = 0; i < shm_channel_count; ++i)
+        {
+            shm_channel& ch = segment_.channel(i);
+            std::uint32_t expected = static_cast<std::uint32_t>(shm_channel_state::free);
+            if (ch.state.compare_exchange_strong(expected, static_cast<std::uint32_t>(shm_channel_state::busy)))
+            {
+                ch.owner_pid.store(getpid());
+                channel_ = &ch;
+                return;
+            }
+        }
+        throw std::runtime_error("No free shared memory channel");
+    }
+
+    void disconnect()
+    {
+        if (channel_ != nullptr && !is_busy())
+        {
+            release();
+        }
+    }
+
+private:
+    void write(const request_header& head, const std::string& protocol, const std::string& body)
+    {
+        if (head.protocol_len + head.body_len + request_header_len > shm_ring_size)
+        {
+            throw std::runtime_error("Send data is too big");
+        }
+
+        while (!channel_->request.try_write({ { &head, sizeof(head) }, { protocol.data(), protocol.size() },
+                                              { body.data(), body.size() } }))
+        {
+            check_busy();
+            std::this_thread::yield();
+        }
+
+        shm_segment_header& header = segment_.header();
+        header.doorbell.fetch_add(1);
+        if (header.server_waiting.load())
+        {
+            futex_wake(header.doorbell);
+        }
+    }
+
+    std::vector<char> read(unsigned int request_id, std::size_t budget_milli)
+    {
+        auto begin_time = std::chrono::steady_clock::now();
+        std::size_t spin_count = 0;
+        while (true)
+        {
+            std::uint32_t seq = channel_->response_seq.load();
+            if (channel_->response.readable() >= response_header_len)
+            {
+                response_header res_head;
+                channel_->response.read(&res_head, response_header_len);
+                std::vector<char> body(res_head.body_len);
+                channel_->response.read(body.data(), body.size());
+                // 之前超时取消的请求，服务端已经开始执行时仍会应答，丢弃即可.
+                if (res_head.request_id != request_id)
+                {
+                    continue;
+                }
+
+                if (res_head.status != rpc_status::ok)
+                {
+                    throw_rpc_error(res_head.status, std::string(body.begin(), body.end()));
+                }
+                return body;
+            }
+            check_busy();
+
+            if (++spin_count < max_spin_count)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+
+            std::size_t wait_milli = max_wait_milli;
+            if (budget_milli != 0)
+            {
+                auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin_time);
+                if (static_cast<std::size_t>(elapsed.count()) >= budget_milli)
+                {
+                    // 只取消这一个请求，通道继续复用.
+                    write(request_header{ 0, 0, call_mode::cancel, 0, request_id, priority::unspecified, 0 }, "", "");
+                    throw std::runtime_error("Timeout");
+                }
+                wait_milli = std::min(wait_milli, budget_milli - static_cast<std::size_t>(elapsed.count()));
+            }
+
+            channel_->client_waiting.store(1);
+            futex_wait(channel_->response_seq, seq, wait_milli);
+            channel_->client_waiting.store(0);
+        }
+    }
+
+    bool is_busy()
+    {
+        return channel_->state.load() == static_cast<std::uint32_t>(shm_channel_state::busy);
+    }
+
+    void check_busy()
+    {
+        if (!is_busy())
+        {
+            release();
+            throw std::runtime_error("Shared memory channel closed");
+        }
+    }
+
+    void release()
+    {
+        if (channel_ == nullptr)
+        {
+            return;
+        }
+
+        channel_->state.store(static_cast<std::uint32_t>(shm_channel_state::closing));
+        shm_segment_header& header = segment_.header();
+        header.doorbell.fetch_add(1);
+        futex_wake(header.doorbell);
+        channel_ = nullptr;
+    }
+
+private:
+    static const std::size_t max_spin_count = 1000;
+    static const std::size_t max_wait_milli = 100;
+    shm_segment segment_;
+    shm_channel* channel_ = nullptr;
+};
+
+}
+
+#endif
+#endif
@@ -1,6 +1,7 @@
 #ifndef _EASYRPC_H
 #define _EASYRPC_H
 
+#include "base/io_backend.hpp"
 #include "server/server.hpp"
 #include "client/client.hpp"
 
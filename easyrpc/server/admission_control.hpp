@@ -0,0 +1,132 @@
+#ifndef _ADMISSION_CONTROL_H
+#define _ADMISSION_CONTROL_H
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <algorithm>
+
+namespace easyrpc
+{
+
+static const std::size_t min_accept_backoff_milli = 1;
+static const std::size_t max_accept_backoff_milli = 100;
+static const std::size_t max_retained_buffer_len = 64 * 1024;
+
+// 连接数达到上限时如何处理新连接.
+enum class admission_policy
+{
+    backlog,        // 暂停accept，新连接留在内核的backlog中排队
+    reject          // accept后立即关闭，客户端尽快重试其他server
+};
+
+// 限制连接数和所有连接已读入、尚未处理完的请求占用的内存，上限为0表示不限制.
+class admission_control
+{
+public:
+    admission_control() = default;
+    admission_control(const admission_control&) = delete;
+    admission_control& operator=(const admission_control&) = delete;
+
+    void set_max_connections(std::size_t max_connections, admission_policy policy)
+    {
+        max_connections_ = max_connections;
+        policy_ = policy;
+    }
+
+    void set_max_buffered_bytes(std::size_t max_bytes)
+    {
+        max_buffered_bytes_ = max_bytes;
+    }
+
+    admission_policy policy() const
+    {
+        return policy_;
+    }
+
+    std::size_t max_buffered_bytes() const
+    {
+        return max_buffered_bytes_;
+    }
+
+    bool try_admit()
+    {
+        return try_add(connections_, 1, max_connections_);
+    }
+
+    void release_connection()
+    {
+        connections_.fetch_sub(1);
+    }
+
+    bool try_reserve(std::size_t bytes)
+    {
+        return try_add(buffered_bytes_, bytes, max_buffered_bytes_);
+    }
+
+    void release(std::size_t bytes)
+    {
+        buffered_bytes_.fetch_sub(bytes);
+    }
+
+    std::size_t connections() const
+    {
+        return connections_.load();
+    }
+
+    std::size_t buffered_bytes() const
+    {
+        return buffered_bytes_.load();
+    }
+
+private:
+    static bool try_add(std::atomic<std::size_t>& value, std::size_t n, std::size_t limit)
+    {
+        std::size_t current = value.load();
+        do
+        {
+            if (limit != 0 && current + n > limit)
+            {
+                return false;
+            }
+        } while (!value.compare_exchange_weak(current, current + n));
+        return true;
+    }
+
+private:
+    std::size_t max_connections_ = 0;
+    std::size_t max_buffered_bytes_ = 0;
+    admission_policy policy_ = admission_policy::backlog;
+    std::atomic<std::size_t> connections_{ 0 };
+    std::atomic<std::size_t> buffered_bytes_{ 0 };
+};
+
+// 在admission上预留的请求内存，最后一个持有者销毁时归还.
+inline std::shared_ptr<void> make_reservation(admission_control& admission, std::size_t bytes)
+{
+    return std::shared_ptr<void>(nullptr, [&admission, bytes](void*){ admission.release(bytes); });
+}
+
+// 没有成功时等待时间加倍，成功后恢复.
+class backoff
+{
+public:
+    std::size_t next_milli()
+    {
+        std::size_t milli = milli_;
+        milli_ = std::min(milli_ * 2, max_accept_backoff_milli);
+        return milli;
+    }
+
+    void reset()
+    {
+        milli_ = min_accept_backoff_milli;
+    }
+
+private:
+    std::size_t milli_ = min_accept_backoff_milli;
+};
+
+}
+
+#endif
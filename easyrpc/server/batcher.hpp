@@ -0,0 +1,125 @@
+#ifndef _BATCHER_H
+#define _BATCHER_H
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <memory>
+#include <chrono>
+#include <functional>
+#include <condition_variable>
+#include "base/header.hpp"
+#include "base/request_context.hpp"
+
+namespace easyrpc
+{
+
+// bind_batch协议排队中的一个请求，reply把结果写回它所在的连接.
+struct batch_item
+{
+    using reply_t = std::function<void(const request_context& ctx, const std::string& body, rpc_status status)>;
+    std::string body;
+    request_context ctx;
+    reply_t reply;
+};
+
+using batch_t = std::vector<batch_item>;
+
+// 把来自各个连接的同一协议的请求攒成一批：攒满max_batch_size个立即提交，
+// 否则从第一个请求到达起最多等待max_delay_micro，由后台线程提交.
+class batcher
+{
+public:
+    using clock_type = std::chrono::steady_clock;
+    using submit_t = std::function<void(batch_t&& batch)>;
+
+    batcher(std::size_t max_batch_size, std::size_t max_delay_micro, const submit_t& submit)
+        : max_batch_size_(max_batch_size == 0 ? 1 : max_batch_size), max_delay_(max_delay_micro), submit_(submit)
+    {
+        thread_ = std::make_unique<std::thread>([this]{ run(); });
+    }
+
+    batcher(const batcher&) = delete;
+    batcher& operator=(const batcher&) = delete;
+
+    ~batcher()
+    {
+        stop();
+    }
+
+    void add(batch_item&& item)
+    {
+        batch_t full;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (pending_.empty())
+            {
+                flush_time_ = clock_type::now() + max_delay_;
+                cond_.notify_one();
+            }
+
+            pending_.emplace_back(std::move(item));
+            if (pending_.size() < max_batch_size_)
+            {
+                return;
+            }
+            full.swap(pending_);
+        }
+        submit_(std::move(full));
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            is_stop_ = true;
+        }
+        cond_.notify_all();
+        if (thread_ != nullptr && thread_->joinable())
+        {
+            thread_->join();
+        }
+    }
+
+private:
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!is_stop_)
+        {
+            if (pending_.empty())
+            {
+                cond_.wait(lock);
+                continue;
+            }
+
+            if (clock_type::now() < flush_time_)
+            {
+                cond_.wait_until(lock, flush_time_);
+                continue;
+            }
+
+            batch_t batch;
+            batch.swap(pending_);
+            lock.unlock();
+            submit_(std::move(batch));
+            lock.lock();
+        }
+    }
+
+private:
+    std::size_t max_batch_size_;
+    std::chrono::microseconds max_delay_;
+    submit_t submit_;
+    std::unique_ptr<std::thread> thread_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    batch_t pending_;
+    clock_type::time_point flush_time_;
+    bool is_stop_ = false;
+};
+
+}
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef _BIND_OPTIONS_H
+#define _BIND_OPTIONS_H
+
+#include <cstddef>
+#include "base/header.hpp"
+
+namespace easyrpc
+{
+
+static const std::size_t default_max_batch_size = 64;
+static const std::size_t default_max_batch_delay_micro = 1000;
+
+// bind时为协议指定的调度选项.
+struct bind_options
+{
+    priority prio = priority::normal;                                   // 客户端未指定优先级时使用
+    std::size_t max_batch_size = default_max_batch_size;                // 仅对bind_batch有效
+    std::size_t max_batch_delay_micro = default_max_batch_delay_micro;  // 仅对bind_batch有效
+    bool single_flight = false;                                         // 相同请求体的并发请求只执行一次handler
+};
+
+}
+
+#endif
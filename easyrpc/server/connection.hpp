@@ -3,12 +3,19 @@
 
 #include <vector>
 #include <memory>
+#include <mutex>
+#include <condition_variable>
+#include "base/io_backend.hpp"
 #include <boost/asio.hpp>
 #include <boost/timer.hpp>
 #include "base/header.hpp"
 #include "base/atimer.hpp"
 #include "base/scope_guard.hpp"
 #include "base/logger.hpp"
+#include "base/tracer.hpp"
+#include "inflight_requests.hpp"
+#include "flow_control.hpp"
+#include "admission_control.hpp"
 #include "router.hpp"
 
 namespace easyrpc
@@ -21,46 +28,100 @@ public:
     connection() = default;
     connection(const connection&) = delete;
     connection& operator=(const connection&) = delete;
-    connection(boost::asio::io_service& ios, std::size_t timeout_milli = 0)
-        : socket_(ios), timer_(ios), timeout_milli_(timeout_milli) {}
+    // admission不为空时，连接已经在admission上占了一个名额，析构时归还.
+    connection(boost::asio::io_service& ios, std::size_t timeout_milli = 0, admission_control* admission = nullptr)
+        : ios_(ios), socket_(ios), timer_(ios), timeout_milli_(timeout_milli), admission_(admission), memory_timer_(ios) {}
 
     ~connection()
     {
         stop_timer();
-        disconnect();
+        // 没有未完成的异步操作了，可以在任意线程上关闭.
+        inflight_.cancel_all();
+        close_socket();
+        release_buffer();
+        if (admission_ != nullptr)
+        {
+            admission_->release_connection();
+        }
     }
 
     void start()
     {
+        accept_time_ = tracer::clock_type::now();
+        init_flow();
         set_no_delay();
+        init_timer();
         read_head();
     }
 
-    boost::asio::ip::tcp::socket& socket()
+    boost::asio::generic::stream_protocol::socket& socket()
     {
         return socket_;
     }
 
-    void write(const std::string& body)
+    // 没有正在写出的数据时立即发起写操作；正在写出时到达的应答先攒在pending_中，上一次写完后一起写出，
+    // 多个应答只需要一次系统调用；对端不读取时worker线程在这里等待，io线程上不能等待；
+    // trace_id不为0时在应答真正写入socket后记录write_complete.
+    void write(unsigned int request_id, const std::string& body, rpc_status status = rpc_status::ok, 
+               const cancel_token& token = nullptr, unsigned int trace_id = 0)
     {
+        inflight_.remove(request_id, token);
         unsigned int body_len = static_cast<unsigned int>(body.size());
         if (body_len > max_buffer_len)
         {
             throw std::runtime_error("Send data is too big");
         }
 
-        const auto& buffer = get_buffer(response_header{ body_len }, body);
-        write_impl(buffer);
+        // 长连接上多个worker线程可能同时应答，应答顺序与请求顺序无关.
+        response_header head{ body_len, status, request_id };
+        std::unique_lock<std::mutex> lock(write_mutex_);
+        if (!ios_.get_executor().running_in_this_thread())
+        {
+            write_drained_.wait(lock, [this]
+            { 
+                return pending_.size() < static_cast<std::size_t>(max_pending_write_len) || is_write_closed_; 
+            });
+        }
+
+        if (is_write_closed_)
+        {
+            return;
+        }
+
+        pending_.append(reinterpret_cast<const char*>(&head), sizeof(response_header));
+        pending_.append(body);
+        if (trace_id != 0)
+        {
+            pending_traces_.emplace_back(trace_id, request_id);
+        }
+        if (!is_writing_)
+        {
+            start_flush();
+        }
+    }
+
+    cancel_token add_request(unsigned int request_id)
+    {
+        return inflight_.add(request_id);
+    }
+
+    std::uint64_t flow_id(flow_key key) const
+    {
+        return key == flow_key::client_address ? address_flow_ : connection_flow_;
     }
 
+    // worker线程上应答失败时也会调用，socket只在io线程上关闭，不与io线程上的读写并发.
     void disconnect()
     {
-        if (socket_.is_open())
+        // 连接断开后还在排队的请求没有必要再执行.
+        inflight_.cancel_all();
+        if (!ios_.get_executor().running_in_this_thread())
         {
-            boost::system::error_code ignore_ec;
-            socket_.shutdown(boost::asio::socket_base::shutdown_both, ignore_ec);
-            socket_.close(ignore_ec);
+            auto self(this->shared_from_this());
+            ios_.post([this, self]{ close_socket(); });
+            return;
         }
+        close_socket();
     }
 
 private:
@@ -80,12 +141,25 @@ private:
 
             if (ec)
             {
-                log_warn(ec.message());
+                if (ec != boost::asio::error::eof)
+                {
+                    log_warn(ec.message());
+                }
+                return;
+            }
+
+            memcpy(&req_head_, head_, sizeof(head_));
+            if (req_head_.mode == call_mode::cancel)
+            {
+                inflight_.cancel(req_head_.request_id);
+                read_head();
+                guard.dismiss();
                 return;
             }
 
             if (check_head())
             {
+                trace_head();
                 read_protocol_and_body();
                 guard.dismiss();
             }
@@ -94,19 +168,35 @@ private:
 
     bool check_head()
     {
-        memcpy(&req_head_, head_, sizeof(head_));
         unsigned int len = req_head_.protocol_len + req_head_.body_len;
         return (len > 0 && len < max_buffer_len) ? true : false;
     }
 
+    // 所有连接缓存的请求超过上限时暂停读取，请求留在socket缓冲区中，由TCP流控让客户端放慢.
     void read_protocol_and_body()
     {
-        protocol_and_body_.clear();
-        protocol_and_body_.resize(req_head_.protocol_len + req_head_.body_len);
+        std::size_t len = req_head_.protocol_len + req_head_.body_len;
+        if (admission_ != nullptr && !admission_->try_reserve(len))
+        {
+            if (len > admission_->max_buffered_bytes())
+            {
+                log_warn("Request exceeds buffered memory limit: {}", len);
+                stop_timer();
+                disconnect();
+                return;
+            }
+            wait_for_memory();
+            return;
+        }
+
+        reserved_len_ = admission_ != nullptr ? len : 0;
+        memory_backoff_.reset();
+        protocol_and_body_.resize(len);
         auto self(this->shared_from_this());
         boost::asio::async_read(socket_, boost::asio::buffer(protocol_and_body_), 
                                 [this, self](boost::system::error_code ec, std::size_t)
         {
+            auto release = make_guard([this]{ release_buffer(); });
             stop_timer();
             if (!socket_.is_open())
             {
@@ -121,18 +211,126 @@ private:
                 return;
             }
 
-            bool ok = router::instance().route(std::string(&protocol_and_body_[0], req_head_.protocol_len), 
-                                               std::string(&protocol_and_body_[req_head_.protocol_len], req_head_.body_len), 
-                                               req_head_.mode, self);
-            if (!ok)
+            tracer::instance().record(req_head_.trace_id, req_head_.request_id, trace_point::body_read);
+            router::instance().route(std::string(&protocol_and_body_[0], req_head_.protocol_len), 
+                                     std::string(&protocol_and_body_[req_head_.protocol_len], req_head_.body_len), 
+                                     req_head_, self, take_reservation());
+            // 长连接，继续读取下一个请求.
+            continue_reading();
+            guard.dismiss();
+        });
+    }
+
+    // io线程上的应答(过载、限流、thread_per_core等)不能等待写出，对端只发不收时暂停读取，
+    // 不再产生新的应答，积压的应答写出后由flush恢复读取.
+    void continue_reading()
+    {
+        {
+            std::lock_guard<std::mutex> lock(write_mutex_);
+            if (pending_.size() >= static_cast<std::size_t>(max_pending_write_len) && !is_write_closed_)
             {
-                log_warn("Router failed");
+                is_read_paused_ = true;
                 return;
             }
-            guard.dismiss();
+        }
+        read_head();
+    }
+
+    void wait_for_memory()
+    {
+        auto self(this->shared_from_this());
+        memory_timer_.expires_from_now(std::chrono::milliseconds(memory_backoff_.next_milli()));
+        memory_timer_.async_wait([this, self](boost::system::error_code ec)
+        {
+            if (ec || !socket_.is_open())
+            {
+                return;
+            }
+            read_protocol_and_body();
         });
     }
 
+    // 额度转交给请求，排队中的请求仍计入上限，任务执行完或被丢弃后归还.
+    std::shared_ptr<void> take_reservation()
+    {
+        if (reserved_len_ == 0)
+        {
+            return nullptr;
+        }
+
+        std::size_t len = reserved_len_;
+        reserved_len_ = 0;
+        return make_reservation(*admission_, len);
+    }
+
+    // 读取失败时归还额度；偶尔的大请求不应让空闲连接一直占着大块内存.
+    void release_buffer()
+    {
+        if (reserved_len_ != 0)
+        {
+            admission_->release(reserved_len_);
+            reserved_len_ = 0;
+        }
+
+        if (protocol_and_body_.capacity() > max_retained_buffer_len)
+        {
+            std::vector<char>().swap(protocol_and_body_);
+        }
+        else
+        {
+            protocol_and_body_.clear();
+        }
+    }
+
+    // 客户端没有带trace_id的请求由服务端生成，连接上第一个被跟踪的请求补记accept的时刻.
+    void trace_head()
+    {
+        tracer& t = tracer::instance();
+        if (!t.is_enabled())
+        {
+            return;
+        }
+
+        if (req_head_.trace_id == 0)
+        {
+            req_head_.trace_id = t.next_trace_id();
+        }
+
+        if (!is_accept_traced_)
+        {
+            t.record(req_head_.trace_id, req_head_.request_id, trace_point::accept, accept_time_);
+            is_accept_traced_ = true;
+        }
+        t.record(req_head_.trace_id, req_head_.request_id, trace_point::header_read);
+    }
+
+    // unix域socket没有可区分的地址，按对端进程区分客户端.
+    void init_flow()
+    {
+        connection_flow_ = next_connection_flow();
+        address_flow_ = connection_flow_;
+        const sockaddr* addr = nullptr;
+        boost::system::error_code ec;
+        auto endpoint = socket_.remote_endpoint(ec);
+        if (!ec)
+        {
+            addr = endpoint.data();
+        }
+
+        if (addr != nullptr && (addr->sa_family == AF_INET || addr->sa_family == AF_INET6))
+        {
+            address_flow_ = address_flow(addr);
+            return;
+        }
+
+        ucred cred;
+        socklen_t len = sizeof(cred);
+        if (getsockopt(socket_.native_handle(), SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0)
+        {
+            address_flow_ = process_flow(cred.pid);
+        }
+    }
+
     void set_no_delay()
     {
         boost::asio::ip::tcp::no_delay option(true);
@@ -140,16 +338,32 @@ private:
         socket_.set_option(option, ec);
     }
 
-    void start_timer()
+    void init_timer()
     {
         if (timeout_milli_ == 0)
         {
             return;
         }
 
-        auto self(this->shared_from_this());
-        timer_.bind([this, self]{ disconnect(); });
+        // 只持有weak_ptr，timer_是成员，持有shared_ptr会造成循环引用.
+        std::weak_ptr<connection> weak(this->shared_from_this());
+        timer_.bind([weak]
+        { 
+            auto self = weak.lock();
+            if (self != nullptr)
+            {
+                self->disconnect(); 
+            }
+        });
         timer_.set_single_shot(true);
+    }
+
+    void start_timer()
+    {
+        if (timeout_milli_ == 0)
+        {
+            return;
+        }
         timer_.start(timeout_milli_);
     }
 
@@ -162,31 +376,129 @@ private:
         timer_.stop();
     }
 
-    std::vector<boost::asio::const_buffer> get_buffer(const response_header& head, const std::string& body)
+    void close_socket()
+    {
+        if (socket_.is_open())
+        {
+            boost::system::error_code ignore_ec;
+            socket_.shutdown(boost::asio::socket_base::shutdown_both, ignore_ec);
+            socket_.close(ignore_ec);
+        }
+    }
+
+    // 调用方需持有write_mutex_；worker线程上的应答交给io线程发起写操作.
+    void start_flush()
     {
-        std::vector<boost::asio::const_buffer> buffer;
-        buffer.emplace_back(boost::asio::buffer(&head, sizeof(response_header)));
-        buffer.emplace_back(boost::asio::buffer(body));
-        return buffer;
+        is_writing_ = true;
+        if (ios_.get_executor().running_in_this_thread())
+        {
+            flush();
+            return;
+        }
+
+        auto self(this->shared_from_this());
+        ios_.post([this, self]
+        {
+            std::lock_guard<std::mutex> lock(write_mutex_);
+            flush();
+        });
     }
 
-    void write_impl(const std::vector<boost::asio::const_buffer>& buffer)
+    // 在io线程上执行，调用方需持有write_mutex_；写完的回调接着写出期间攒下的应答.
+    void flush()
     {
-        boost::system::error_code ec;
-        boost::asio::write(socket_, buffer, ec);
-        if (ec)
+        if (!socket_.is_open())
         {
-            throw std::runtime_error(ec.message());
+            is_writing_ = false;
+            is_write_closed_ = true;
+            pending_.clear();
+            pending_traces_.clear();
+            write_drained_.notify_all();
+            return;
         }
+
+        writing_.swap(pending_);
+        pending_.clear();
+        writing_traces_.swap(pending_traces_);
+        pending_traces_.clear();
+        is_writing_ = true;
+        auto self(this->shared_from_this());
+        boost::asio::async_write(socket_, boost::asio::buffer(writing_), 
+                                 [this, self](boost::system::error_code ec, std::size_t)
+        {
+            std::unique_lock<std::mutex> lock(write_mutex_);
+            is_writing_ = false;
+            if (writing_.capacity() > max_retained_buffer_len)
+            {
+                std::string().swap(writing_);
+            }
+            else
+            {
+                writing_.clear();
+            }
+
+            if (!ec)
+            {
+                for (auto& t : writing_traces_)
+                {
+                    tracer::instance().record(t.first, t.second, trace_point::write_complete);
+                }
+            }
+            writing_traces_.clear();
+
+            if (ec)
+            {
+                is_write_closed_ = true;
+                pending_.clear();
+                pending_traces_.clear();
+                write_drained_.notify_all();
+                lock.unlock();
+                log_warn(ec.message());
+                disconnect();
+                return;
+            }
+
+            if (!pending_.empty())
+            {
+                flush();
+            }
+            write_drained_.notify_all();
+
+            if (is_read_paused_ && pending_.size() < static_cast<std::size_t>(max_pending_write_len))
+            {
+                is_read_paused_ = false;
+                lock.unlock();
+                read_head();
+            }
+        });
     }
 
 private:
-    boost::asio::ip::tcp::socket socket_;
+    boost::asio::io_service& ios_;
+    boost::asio::generic::stream_protocol::socket socket_;
     char head_[request_header_len];
     request_header req_head_;
     std::vector<char> protocol_and_body_;
     atimer<> timer_;
     std::size_t timeout_milli_ = 0;
+    std::mutex write_mutex_;
+    std::condition_variable write_drained_;
+    std::string pending_;
+    std::string writing_;
+    std::vector<std::pair<unsigned int, unsigned int>> pending_traces_;     // trace_id, request_id
+    std::vector<std::pair<unsigned int, unsigned int>> writing_traces_;
+    bool is_writing_ = false;
+    bool is_write_closed_ = false;
+    bool is_read_paused_ = false;
+    inflight_requests inflight_;
+    tracer::clock_type::time_point accept_time_;
+    bool is_accept_traced_ = false;
+    std::uint64_t connection_flow_ = 0;
+    std::uint64_t address_flow_ = 0;
+    admission_control* admission_ = nullptr;
+    std::size_t reserved_len_ = 0;
+    boost::asio::steady_timer memory_timer_;
+    backoff memory_backoff_;
 };
 
 }
@@ -0,0 +1,154 @@
+#ifndef _FLOW_CONTROL_H
+#define _FLOW_CONTROL_H
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <algorithm>
+#include <unordered_map>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+namespace easyrpc
+{
+
+// worker队列按什么划分flow轮流出队，限流也按同样的划分.
+enum class flow_key
+{
+    none,               // 不区分，先进先出
+    connection,         // 每个连接一个flow
+    client_address      // 同一个客户端地址(共享内存为同一个进程)的所有连接一个flow
+};
+
+// 请求按body大小折算排队额度，大请求占用更多的轮次.
+static const std::size_t flow_cost_unit = 4096;
+
+inline std::size_t request_cost(std::size_t body_len)
+{
+    return 1 + body_len / flow_cost_unit;
+}
+
+// tcp连接和共享内存连接共用一个编号空间.
+inline std::uint64_t next_connection_flow()
+{
+    static std::atomic<std::uint64_t> next{ 1 };
+    return next.fetch_add(1, std::memory_order_relaxed);
+}
+
+// 同一进程的所有共享内存连接是一个客户端，最高位区分进程号和网络地址.
+inline std::uint64_t process_flow(pid_t pid)
+{
+    return (static_cast<std::uint64_t>(1) << 63) | static_cast<std::uint64_t>(pid);
+}
+
+// 只取ip，忽略端口，同一机器上的多个连接归为一个客户端.
+inline std::uint64_t address_flow(const sockaddr* addr)
+{
+    std::string bytes;
+    if (addr->sa_family == AF_INET)
+    {
+        auto in = reinterpret_cast<const sockaddr_in*>(addr);
+        bytes.assign(reinterpret_cast<const char*>(&in->sin_addr), sizeof(in->sin_addr));
+    }
+    else if (addr->sa_family == AF_INET6)
+    {
+        auto in6 = reinterpret_cast<const sockaddr_in6*>(addr);
+        bytes.assign(reinterpret_cast<const char*>(&in6->sin6_addr), sizeof(in6->sin6_addr));
+    }
+    return std::hash<std::string>()(bytes) & ~(static_cast<std::uint64_t>(1) << 63);
+}
+
+// 每个flow一个令牌桶，每秒补充rate个，最多攒burst个，长时间不活跃的桶被回收.
+class rate_limiter
+{
+public:
+    using clock_type = std::chrono::steady_clock;
+
+    rate_limiter() = default;
+    rate_limiter(const rate_limiter&) = delete;
+    rate_limiter& operator=(const rate_limiter&) = delete;
+
+    // rate为0时不限流.
+    void set(double rate, double burst)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        rate_ = rate;
+        burst_ = std::max(burst, 1.0);
+        bucket_map_.clear();
+        is_enabled_ = rate != 0;
+    }
+
+    // 每个请求都会检查，不加锁.
+    bool is_enabled() const
+    {
+        return is_enabled_;
+    }
+
+    bool allow(std::uint64_t flow)
+    {
+        auto now = clock_type::now();
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (++calls_ % sweep_interval == 0)
+        {
+            sweep(now);
+        }
+
+        auto iter = bucket_map_.find(flow);
+        if (iter == bucket_map_.end())
+        {
+            iter = bucket_map_.emplace(flow, bucket{ burst_, now }).first;
+        }
+
+        bucket& b = iter->second;
+        double seconds = std::chrono::duration<double>(now - b.last_time).count();
+        b.tokens = std::min(burst_, b.tokens + seconds * rate_);
+        b.last_time = now;
+        if (b.tokens < 1)
+        {
+            return false;
+        }
+        b.tokens -= 1;
+        return true;
+    }
+
+private:
+    struct bucket
+    {
+        double tokens;
+        clock_type::time_point last_time;
+    };
+
+    // 不活跃到桶已经攒满的flow与新flow没有区别，可以回收.
+    void sweep(clock_type::time_point now)
+    {
+        for (auto iter = bucket_map_.begin(); iter != bucket_map_.end();)
+        {
+            double seconds = std::chrono::duration<double>(now - iter->second.last_time).count();
+            if (iter->second.tokens + seconds * rate_ >= burst_)
+            {
+                iter = bucket_map_.erase(iter);
+            }
+            else
+            {
+                ++iter;
+            }
+        }
+    }
+
+private:
+    static const std::uint64_t sweep_interval = 4096;
+    std::mutex mutex_;
+    std::atomic<bool> is_enabled_{ false };
+    double rate_ = 0;
+    double burst_ = 1;
+    std::uint64_t calls_ = 0;
+    std::unordered_map<std::uint64_t, bucket> bucket_map_;
+};
+
+}
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef _INFLIGHT_REQUESTS_H
+#define _INFLIGHT_REQUESTS_H
+
+#include <mutex>
+#include <unordered_map>
+#include "base/request_context.hpp"
+
+namespace easyrpc
+{
+
+// 一个连接上尚未应答的请求，收到取消帧或者连接断开时置位对应的cancel_token；
+// request_id由客户端选择，可能重复，应答时按token删除，不会删掉同id的另一个请求.
+class inflight_requests
+{
+public:
+    inflight_requests() = default;
+    inflight_requests(const inflight_requests&) = delete;
+    inflight_requests& operator=(const inflight_requests&) = delete;
+
+    cancel_token add(unsigned int request_id)
+    {
+        cancel_token token = make_cancel_token();
+        std::lock_guard<std::mutex> lock(mutex_);
+        token_map_.emplace(request_id, token);
+        return token;
+    }
+
+    void remove(unsigned int request_id, const cancel_token& token)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto range = token_map_.equal_range(request_id);
+        for (auto iter = range.first; iter != range.second; ++iter)
+        {
+            if (iter->second == token)
+            {
+                token_map_.erase(iter);
+                return;
+            }
+        }
+    }
+
+    // 同id的请求无法区分，一起取消.
+    void cancel(unsigned int request_id)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto range = token_map_.equal_range(request_id);
+        for (auto iter = range.first; iter != range.second; ++iter)
+        {
+            iter->second->store(true);
+        }
+        token_map_.erase(range.first, range.second);
+    }
+
+    void cancel_all()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& iter : token_map_)
+        {
+            iter.second->store(true);
+        }
+        token_map_.clear();
+    }
+
+private:
+    std::mutex mutex_;
+    std::unordered_multimap<unsigned int, cancel_token> token_map_;
+};
+
+}
+
+#endif
@@ -4,8 +4,11 @@
 #include <vector>
 #include <memory>
 #include <thread>
+#include <atomic>
+#include "base/io_backend.hpp"
 #include <boost/asio.hpp>
-#include <boost/bind.hpp>
+#include "base/thread_util.hpp"
+#include "base/busy_poll.hpp"
 
 namespace easyrpc
 {
@@ -24,7 +27,20 @@ public:
             throw std::runtime_error("io server pool size is 0");
         }
         
-        for (std::size_t i = 0; i < pool_size; ++i)
+        resize(pool_size);
+    }
+
+    // 只能在run之前调用，缩小时保留前面的io_service，已经绑定在上面的acceptor不受影响.
+    void resize(std::size_t pool_size)
+    {
+        if (pool_size == 0)
+        {
+            throw std::runtime_error("io server pool size is 0");
+        }
+
+        ios_vec_.resize(std::min(pool_size, ios_vec_.size()));
+        work_vec_.resize(ios_vec_.size());
+        while (ios_vec_.size() < pool_size)
         {
             io_service_ptr ios = std::make_shared<boost::asio::io_service>();
             work_ptr work = std::make_shared<boost::asio::io_service::work>(*ios);
@@ -37,11 +53,35 @@ public:
     {
         for (std::size_t i = 0; i < ios_vec_.size(); ++i)
         {
-            thread_ptr t = std::make_shared<std::thread>(boost::bind(&boost::asio::io_service::run, ios_vec_[i]));
+            io_service_ptr ios = ios_vec_[i];
+            std::size_t spin_micro = spin_micro_;
+            thread_ptr t = std::make_shared<std::thread>([ios, spin_micro]{ run_busy_poll(*ios, spin_micro); });
+            if (!cpus_.empty())
+            {
+                thread_util::set_affinity(*t, { cpus_[i % cpus_.size()] });
+            }
             thread_vec_.emplace_back(t);
         }
     }
 
+    // 第i个io线程绑定到cpus[i % cpus.size()].
+    void set_cpus(const std::vector<std::size_t>& cpus)
+    {
+        cpus_ = cpus;
+        cpu_nodes_ = thread_util::cpu_numa_nodes();
+    }
+
+    // io线程没有事件时先自旋spin_micro再睡眠，需在run之前调用.
+    void set_busy_poll(std::size_t spin_micro)
+    {
+        spin_micro_ = spin_micro;
+    }
+
+    bool is_pinned() const
+    {
+        return !cpus_.empty();
+    }
+
     void stop()
     {
         stop_io_services();
@@ -50,16 +90,48 @@ public:
 
     boost::asio::io_service& get_io_service()
     {
-        boost::asio::io_service& ios = *ios_vec_[next_io_service_];
-        ++next_io_service_;
-        if (next_io_service_ == ios_vec_.size())
+        return *ios_vec_[next_io_service_++ % ios_vec_.size()];
+    }
+
+    // 优先选择绑定在cpu上的io线程，其次是同一个NUMA节点上的，都没有则轮询.
+    boost::asio::io_service& get_io_service(int cpu)
+    {
+        if (cpu < 0 || cpus_.empty())
+        {
+            return get_io_service();
+        }
+
+        for (std::size_t i = 0; i < ios_vec_.size(); ++i)
         {
-            next_io_service_ = 0;
+            if (cpus_[i % cpus_.size()] == static_cast<std::size_t>(cpu))
+            {
+                return *ios_vec_[i];
+            }
         }
-        return ios;
+
+        int node = numa_node(static_cast<std::size_t>(cpu));
+        std::vector<std::size_t> candidates;
+        for (std::size_t i = 0; i < ios_vec_.size() && node != -1; ++i)
+        {
+            if (numa_node(cpus_[i % cpus_.size()]) == node)
+            {
+                candidates.emplace_back(i);
+            }
+        }
+
+        if (candidates.empty())
+        {
+            return get_io_service();
+        }
+        return *ios_vec_[candidates[next_io_service_++ % candidates.size()]];
     }
 
 private:
+    int numa_node(std::size_t cpu) const
+    {
+        return cpu < cpu_nodes_.size() ? cpu_nodes_[cpu] : -1;
+    }
+
     void stop_io_services()
     {
         for (auto& iter : ios_vec_)
@@ -92,7 +164,10 @@ private:
     std::vector<io_service_ptr> ios_vec_;
     std::vector<work_ptr> work_vec_;
     std::vector<thread_ptr> thread_vec_; 
-    std::size_t next_io_service_ = 0;
+    std::atomic<std::size_t> next_io_service_{ 0 };
+    std::vector<std::size_t> cpus_;
+    std::vector<int> cpu_nodes_;
+    std::size_t spin_micro_ = 0;
 };
 
 }
@@ -9,34 +9,78 @@
 #include "base/header.hpp"
 #include "base/function_traits.hpp"
 #include "base/thread_pool.hpp"
+#include "base/per_core.hpp"
 #include "base/logger.hpp"
+#include "base/rpc_error.hpp"
+#include "base/request_context.hpp"
+#include "base/tracer.hpp"
 #include "parser_util.hpp"
+#include "bind_options.hpp"
+#include "batcher.hpp"
+#include "single_flight.hpp"
+#include "flow_control.hpp"
 
 namespace easyrpc
 {
 
+inline void trace(const request_context& ctx, trace_point point)
+{
+    tracer::instance().record(ctx.trace_id(), ctx.request_id(), point);
+}
+
+// 应答失败说明连接已不可用，只能断开；单向调用和已取消的请求调用方不再等待应答；
+// write_complete由连接在应答写入socket后记录.
+template<typename T>
+void respond(T conn, const request_context& ctx, const std::string& body, rpc_status status)
+{
+    if (ctx.is_one_way() || ctx.is_cancelled())
+    {
+        return;
+    }
+
+    try
+    {
+        conn->write(ctx.request_id(), body, status, ctx.token(), ctx.trace_id());
+    }
+    catch (std::exception& e)
+    {
+        log_warn(e.what());
+        conn->disconnect();
+    }
+}
+
 class invoker_function
 {
 public:
     using function_t = std::function<void(parser_util& parser, std::string& result)>;
     invoker_function() = default;
-    invoker_function(const function_t& func, std::size_t param_size) : func_(func), param_size_(param_size) {}
+    invoker_function(const function_t& func, std::size_t param_size, const bind_options& options) 
+        : func_(func), param_size_(param_size), options_(options) {}
 
     template<typename T>
-    void operator()(const std::string& body, T conn)
+    void operator()(const std::string& body, const request_context& ctx, T conn)
     {
+        std::string result;
+        rpc_status status = rpc_status::ok;
         try
         {
             parser_util parser(body);
-            std::string result;
             func_(parser, result);
-            conn->write(result);
+        }
+        catch (rpc_error& e)
+        {
+            log_warn(e.what());
+            result = e.what();
+            status = e.status();
         }
         catch (std::exception& e)
         {
             log_warn(e.what());
-            conn->disconnect();
+            result = e.what();
+            status = rpc_status::handler_error;
         }
+        trace(ctx, trace_point::handler_end);
+        respond(conn, ctx, result, status);
     }
 
     std::size_t param_size() const
@@ -44,9 +88,15 @@ public:
         return param_size_;
     }
 
+    const bind_options& options() const
+    {
+        return options_;
+    }
+
 private:
     function_t func_ = nullptr;
     std::size_t param_size_ = 0;
+    bind_options options_;
 };
 
 class invoker_function_raw
@@ -54,26 +104,58 @@ class invoker_function_raw
 public:
     using function_t = std::function<void(const std::string& body, std::string& result)>;
     invoker_function_raw() = default;
-    invoker_function_raw(const function_t& func) : func_(func) {}
+    invoker_function_raw(const function_t& func, const bind_options& options) : func_(func), options_(options) {}
 
     template<typename T>
-    void operator()(const std::string& body, T conn)
+    void operator()(const std::string& body, const request_context& ctx, T conn)
     {
+        std::string result;
+        rpc_status status = rpc_status::ok;
         try
         {
-            std::string result;
             func_(body, result);
-            conn->write(result);
         }
-        catch (std::exception& e)
+        catch (rpc_error& e)
         {
             log_warn(e.what());
-            conn->disconnect();
+            result = e.what();
+            status = e.status();
         }
+        trace(ctx, trace_point::handler_end);
+        respond(conn, ctx, result, status);
+    }
+
+    const bind_options& options() const
+    {
+        return options_;
+    }
+
+private:
+    function_t func_ = nullptr;
+    bind_options options_;
+};
+
+// bind_batch的handler，一次处理一批请求.
+class invoker_function_batch
+{
+public:
+    using function_t = std::function<void(batch_t& batch)>;
+    invoker_function_batch() = default;
+    invoker_function_batch(const function_t& func, const bind_options& options) : func_(func), options_(options) {}
+
+    void operator()(batch_t& batch)
+    {
+        func_(batch);
+    }
+
+    const bind_options& options() const
+    {
+        return options_;
     }
 
 private:
     function_t func_ = nullptr;
+    bind_options options_;
 };
 
 class router
@@ -98,48 +180,114 @@ public:
         threadpool_.init_thread_num(num);
     }
 
+    void adaptive_workers(std::size_t min_threads, std::size_t max_threads, std::size_t target_queue_wait_milli, 
+                          std::size_t idle_milli)
+    {
+        threadpool_.set_adaptive(min_threads, max_threads, target_queue_wait_milli, idle_milli);
+    }
+
+    std::size_t worker_count()
+    {
+        return threadpool_.thread_count();
+    }
+
+    void worker_cpus(const std::vector<std::size_t>& cpus)
+    {
+        threadpool_.set_cpus(cpus);
+    }
+
+    void load_shedding(overload_policy policy, std::size_t max_queue_size, std::size_t max_queue_wait_milli)
+    {
+        threadpool_.set_overload_policy(policy, max_queue_size, max_queue_wait_milli);
+    }
+
+    // handler直接在io线程上执行，不经过线程池.
+    void thread_per_core()
+    {
+        is_thread_per_core_ = true;
+    }
+
     void stop()
     {
+        for (auto& iter : batcher_map_)
+        {
+            iter.second->stop();
+        }
         threadpool_.stop();
     }
 
+    void priority_aging(std::size_t aging_milli)
+    {
+        threadpool_.set_priority_aging(aging_milli);
+    }
+
+    void fair_queuing(flow_key key)
+    {
+        flow_key_ = key;
+    }
+
+    void rate_limit(double per_second, double burst)
+    {
+        limiter_.set(per_second, burst);
+    }
+
+    template<typename Function>
+    void bind(const std::string& protocol, const Function& func, const bind_options& options = bind_options())
+    {
+        bind_non_member_func(protocol, func, options);
+    }
+
+    template<typename Function, typename Self>
+    void bind(const std::string& protocol, const Function& func, Self* self, const bind_options& options = bind_options())
+    {
+        bind_member_func(protocol, func, self, options); 
+    }
+
+    template<typename Function, typename Factory>
+    void bind_per_core(const std::string& protocol, const Function& func, const Factory& factory, 
+                       const bind_options& options = bind_options())
+    {
+        bind_per_core_member_func(protocol, func, factory, options);
+    }
+
+    // handler的形式为std::vector<R>(const std::vector<T>&)，对应客户端的协议R(T)，第i个结果应答第i个请求；
+    // 各连接上的请求攒满options.max_batch_size个或等待options.max_batch_delay_micro后一起交给handler.
     template<typename Function>
-    void bind(const std::string& protocol, const Function& func)
+    void bind_batch(const std::string& protocol, const Function& func, const bind_options& options = bind_options())
     {
-        bind_non_member_func(protocol, func);
+        bind_batch_func(protocol, [func](batch_t& batch){ invoker_batch<Function>::apply(func, batch); }, options);
     }
 
     template<typename Function, typename Self>
-    void bind(const std::string& protocol, const Function& func, Self* self)
+    void bind_batch(const std::string& protocol, const Function& func, Self* self, const bind_options& options = bind_options())
     {
-        bind_member_func(protocol, func, self); 
+        using arg_type_t = typename function_traits<Function>::template args<0>::type;
+        using function_t = std::function<typename function_traits<Function>::return_type(arg_type_t)>;
+        function_t member_func = [func, self](arg_type_t args){ return (*self.*func)(args); };
+        bind_batch_func(protocol, [member_func](batch_t& batch){ invoker_batch<function_t>::apply(member_func, batch); }, options);
     }
 
     void unbind(const std::string& protocol)
     {
         invoker_map_.erase(protocol);
+        batcher_map_.erase(protocol);
     }
 
     bool is_bind(const std::string& protocol)
     {
-        auto iter = invoker_map_.find(protocol);
-        if (iter != invoker_map_.end())
-        {
-            return true;
-        }
-        return false;
+        return invoker_map_.find(protocol) != invoker_map_.end() || batcher_map_.find(protocol) != batcher_map_.end();
     }
 
     template<typename Function>
-    void bind_raw(const std::string& protocol, const Function& func)
+    void bind_raw(const std::string& protocol, const Function& func, const bind_options& options = bind_options())
     {
-        bind_non_member_func_raw(protocol, func);
+        bind_non_member_func_raw(protocol, func, options);
     }
 
     template<typename Function, typename Self>
-    void bind_raw(const std::string& protocol, const Function& func, Self* self)
+    void bind_raw(const std::string& protocol, const Function& func, Self* self, const bind_options& options = bind_options())
     {
-        bind_member_func_raw(protocol, func, self); 
+        bind_member_func_raw(protocol, func, self, options); 
     }
 
     void unbind_raw(const std::string& protocol)
@@ -157,39 +305,206 @@ public:
         return false;
     }
 
+    // 未绑定的协议和非法的调用方式以错误状态应答，不再断开连接；
+    // reservation随请求的上下文一起复制到任务中，任务执行完或被丢弃后才释放.
     template<typename T>
-    bool route(const std::string& protocol, const std::string& body, const call_mode& mode, T conn)
-    {
+    void route(const std::string& protocol, const std::string& body, const request_header& head, T conn, 
+               const std::shared_ptr<void>& reservation = nullptr)
+    {
+        // 单向调用没有应答，调用方也无从取消，不登记到连接上.
+        bool one_way = (head.flags & flag_one_way) != 0;
+        request_context ctx(head.request_id, head.budget_milli, one_way ? nullptr : conn->add_request(head.request_id), 
+                            one_way, head.trace_id);
+        ctx.hold(reservation);
+        std::uint64_t flow = 0;
+        if (flow_key_ != flow_key::none || limiter_.is_enabled())
+        {
+            // 没有开启公平排队时按连接限流.
+            flow = conn->flow_id(flow_key_ == flow_key::none ? flow_key::connection : flow_key_);
+            if (limiter_.is_enabled() && !limiter_.allow(flow))
+            {
+                log_warn("Rate limited: {}", protocol);
+                respond(conn, ctx, "Rate limited", rpc_status::overloaded);
+                return;
+            }
+
+            if (flow_key_ == flow_key::none)
+            {
+                flow = 0;
+            }
+        }
+
+        const call_mode& mode = head.mode;
         if (mode == call_mode::non_raw)
         {
             auto iter = invoker_map_.find(protocol);
-            if (iter == invoker_map_.end())
+            if (iter != invoker_map_.end())
+            {
+                invoke(iter->second, protocol, body, head, ctx, flow, conn);
+                return;
+            }
+
+            auto batch_iter = batcher_map_.find(protocol);
+            if (batch_iter == batcher_map_.end())
             {
-                return false;
+                log_warn("Protocol not bound: {}", protocol);
+                respond(conn, ctx, "Protocol not bound: " + protocol, rpc_status::not_bound);
+                return;
             }
 
-            threadpool_.add_task(iter->second, body, conn);
+            batch_iter->second->add({ body, ctx, [conn](const request_context& ctx, const std::string& body, rpc_status status)
+            {
+                respond(conn, ctx, body, status);
+            } });
         }
         else if (mode == call_mode::raw)
         {
             auto iter = invoker_raw_map_.find(protocol);
             if (iter == invoker_raw_map_.end())
             {
-                return false;
+                log_warn("Protocol not bound: {}", protocol);
+                respond(conn, ctx, "Protocol not bound: " + protocol, rpc_status::not_bound);
+                return;
             }
 
-            threadpool_.add_task(iter->second, body, conn);           
+            invoke(iter->second, protocol, body, head, ctx, flow, conn);
         }
         else
         {
             log_warn("Invaild call mode: {}", static_cast<unsigned int>(mode));
-            return false;
+            respond(conn, ctx, "Invaild call mode", rpc_status::invalid_call_mode);
         }
-
-        return true;
     }
 
 private:
+    template<typename Invoker>
+    static priority request_priority(const request_header& head, const Invoker& invoker)
+    {
+        // 不认识的优先级按未指定处理.
+        if (head.prio == priority::unspecified || !is_valid_priority(head.prio))
+        {
+            return invoker.options().prio;
+        }
+        return head.prio;
+    }
+
+    template<typename Invoker, typename T>
+    void invoke(Invoker& invoker, const std::string& protocol, const std::string& body, 
+                const request_header& head, const request_context& ctx, std::uint64_t flow, T conn)
+    {
+        if (!invoker.options().single_flight)
+        {
+            dispatch(invoker, body, ctx, request_priority(head, invoker), flow, conn);
+            return;
+        }
+
+        std::string key;
+        key.reserve(protocol.size() + body.size() + 2);
+        key.push_back(static_cast<char>(head.mode));
+        key.append(protocol);
+        key.push_back('\0');
+        key.append(body);
+        auto group = flights_.join(key, ctx, [conn, ctx](const std::string& result, rpc_status status){ respond(conn, ctx, result, status); });
+        if (group == nullptr)
+        {
+            return;
+        }
+
+        // 结果要发给所有等待者，不随发起者的取消或超时而跳过，所有等待者都取消后才不再执行.
+        request_context flight_ctx(ctx.request_id(), group, ctx.trace_id());
+        dispatch(invoker, body, flight_ctx, request_priority(head, invoker), flow, 
+                 std::make_shared<flight_responder>(flights_, key, group));
+    }
+
+    // 同一优先级内按flow轮流出队，一个调用方排满队列也不会拖慢其他调用方.
+    template<typename Invoker, typename T>
+    void dispatch(Invoker& invoker, const std::string& body, const request_context& ctx, priority prio, 
+                  std::uint64_t flow, T conn)
+    {
+        auto task = [&invoker, body, ctx, conn]
+        {
+            trace(ctx, trace_point::dequeue);
+            // 出队时调用方已经取消或者放弃的请求不再执行handler.
+            if (ctx.is_cancelled())
+            {
+                return;
+            }
+
+            if (ctx.is_expired())
+            {
+                respond(conn, ctx, "Deadline exceeded", rpc_status::deadline_exceeded);
+                return;
+            }
+
+            request_context_scope scope(ctx);
+            trace(ctx, trace_point::handler_start);
+            invoker(body, ctx, conn);
+        };
+
+        trace(ctx, trace_point::enqueue);
+        if (is_thread_per_core_)
+        {
+            task();
+            return;
+        }
+
+        // 过载时立即应答overloaded，不阻塞io线程.
+        auto overloaded = [ctx, conn]{ respond(conn, ctx, "Server overloaded", rpc_status::overloaded); };
+        if (!threadpool_.submit(task, overloaded, prio, flow, request_cost(body.size())))
+        {
+            log_warn("Server overloaded");
+            overloaded();
+        }
+    }
+
+    // 一批请求使用协议的默认优先级，出队时逐个跳过已取消和已超时的请求.
+    void dispatch_batch(const std::shared_ptr<invoker_function_batch>& invoker, batch_t&& batch)
+    {
+        auto items = std::make_shared<batch_t>(std::move(batch));
+        auto task = [invoker, items]
+        {
+            batch_t live;
+            for (auto& item : *items)
+            {
+                if (item.ctx.is_cancelled())
+                {
+                    continue;
+                }
+
+                if (item.ctx.is_expired())
+                {
+                    item.reply(item.ctx, "Deadline exceeded", rpc_status::deadline_exceeded);
+                    continue;
+                }
+                live.emplace_back(std::move(item));
+            }
+
+            if (!live.empty())
+            {
+                (*invoker)(live);
+            }
+        };
+
+        if (is_thread_per_core_)
+        {
+            task();
+            return;
+        }
+
+        auto overloaded = [items]
+        {
+            for (auto& item : *items)
+            {
+                item.reply(item.ctx, "Server overloaded", rpc_status::overloaded);
+            }
+        };
+        if (!threadpool_.submit(task, overloaded, invoker->options().prio))
+        {
+            log_warn("Server overloaded");
+            overloaded();
+        }
+    }
+
     template<typename Function, typename... Args>
     static typename std::enable_if<std::is_void<typename std::result_of<Function(Args...)>::type>::value>::type
     call(const Function& func, const std::tuple<Args...>& tp, std::string& result)
@@ -276,33 +591,32 @@ private:
         static void apply(const Function& func, const Args& args, parser_util& parser, std::string& result)
         {
             using arg_type_t = typename function_traits<Function>::template args<I>::type;
-            try
-            {
-                invoker<Function, I + 1, N>::apply(func, std::tuple_cat(args, 
-                                                   std::make_tuple(parser.get<arg_type_t>())), parser, result);
-            }
-            catch (std::exception& e)
-            {
-                log_warn(e.what());
-            }
+            invoker<Function, I + 1, N>::apply(func, std::tuple_cat(args, 
+                                               std::make_tuple(get_arg<arg_type_t>(parser))), parser, result);
         }
 
         template<typename Args, typename Self>
         static void apply_member(const Function& func, Self* self, const Args& args, parser_util& parser, std::string& result)
         {
             using arg_type_t = typename function_traits<Function>::template args<I>::type;
-            try
-            {
-                invoker<Function, I + 1, N>::apply_member(func, self, std::tuple_cat(args, 
-                                                          std::make_tuple(parser.get<arg_type_t>())), parser, result);
-            }
-            catch (std::exception& e)
-            {
-                log_warn(e.what());
-            }
+            invoker<Function, I + 1, N>::apply_member(func, self, std::tuple_cat(args, 
+                                                      std::make_tuple(get_arg<arg_type_t>(parser))), parser, result);
         }
     }; 
 
+    template<typename Arg>
+    static typename std::decay<Arg>::type get_arg(parser_util& parser)
+    {
+        try
+        {
+            return parser.get<Arg>();
+        }
+        catch (std::exception& e)
+        {
+            throw rpc_error(rpc_status::decode_error, e.what());
+        }
+    }
+
     template<typename Function, std::size_t N>
     class invoker<Function, N, N>
     {
@@ -317,7 +631,7 @@ private:
             }
             catch (std::exception& e)
             {
-                log_warn(e.what());
+                throw rpc_error(rpc_status::handler_error, e.what());
             }
         }
 
@@ -330,7 +644,7 @@ private:
             }  
             catch (std::exception& e)
             {
-                log_warn(e.what());
+                throw rpc_error(rpc_status::handler_error, e.what());
             }
         }
     };
@@ -347,7 +661,7 @@ private:
             }
             catch (std::exception& e)
             {
-                log_warn(e.what());
+                throw rpc_error(rpc_status::handler_error, e.what());
             }
         }
 
@@ -360,44 +674,150 @@ private:
             }
             catch (std::exception& e)
             {
-                log_warn(e.what());
+                throw rpc_error(rpc_status::handler_error, e.what());
             }
         }
     }; 
 
+    // 逐个解码请求的参数，解码失败的请求单独应答，其余的一次交给handler.
+    template<typename Function>
+    class invoker_batch
+    {
+    public:
+        using arg_type_t = typename std::decay<typename function_traits<Function>::template args<0>::type>::type::value_type;
+        using return_type_t = typename function_traits<Function>::return_type;
+
+        static void apply(const Function& func, batch_t& batch)
+        {
+            std::vector<arg_type_t> args;
+            std::vector<batch_item*> items;
+            args.reserve(batch.size());
+            items.reserve(batch.size());
+            for (auto& item : batch)
+            {
+                try
+                {
+                    parser_util parser(item.body);
+                    args.emplace_back(parser.get<arg_type_t>());
+                    items.emplace_back(&item);
+                }
+                catch (std::exception& e)
+                {
+                    log_warn(e.what());
+                    item.reply(item.ctx, e.what(), rpc_status::decode_error);
+                }
+            }
+
+            if (items.empty())
+            {
+                return;
+            }
+
+            std::vector<std::string> results;
+            try
+            {
+                call_batch(func, args, results);
+                if (results.size() != items.size())
+                {
+                    throw std::runtime_error("Batch handler returned " + std::to_string(results.size()) + 
+                                             " results for " + std::to_string(items.size()) + " requests");
+                }
+            }
+            catch (std::exception& e)
+            {
+                log_warn(e.what());
+                for (auto item : items)
+                {
+                    item->reply(item->ctx, e.what(), rpc_status::handler_error);
+                }
+                return;
+            }
+
+            for (std::size_t i = 0; i < items.size(); ++i)
+            {
+                items[i]->reply(items[i]->ctx, results[i], rpc_status::ok);
+            }
+        }
+
+    private:
+        template<typename Return = return_type_t>
+        static typename std::enable_if<std::is_void<Return>::value>::type
+        call_batch(const Function& func, const std::vector<arg_type_t>& args, std::vector<std::string>& results)
+        {
+            func(args);
+            results.assign(args.size(), pack());
+        }
+
+        template<typename Return = return_type_t>
+        static typename std::enable_if<!std::is_void<Return>::value>::type
+        call_batch(const Function& func, const std::vector<arg_type_t>& args, std::vector<std::string>& results)
+        {
+            auto ret = func(args);
+            results.reserve(ret.size());
+            for (auto& r : ret)
+            {
+                results.emplace_back(pack(r));
+            }
+        }
+    };
+
 private:
     template<typename Function>
-    void bind_non_member_func(const std::string& protocol, const Function& func)
+    void bind_non_member_func(const std::string& protocol, const Function& func, const bind_options& options)
     {
         invoker_map_[protocol] = { std::bind(&invoker<Function>::template apply<std::tuple<>>, func, std::tuple<>(), 
-                                             std::placeholders::_1, std::placeholders::_2), function_traits<Function>::arity };
+                                             std::placeholders::_1, std::placeholders::_2), function_traits<Function>::arity, options };
     }
 
     template<typename Function, typename Self>
-    void bind_member_func(const std::string& protocol, const Function& func, Self* self)
+    void bind_member_func(const std::string& protocol, const Function& func, Self* self, const bind_options& options)
     {
         invoker_map_[protocol] = { std::bind(&invoker<Function>::template apply_member<std::tuple<>, Self>, func, self, std::tuple<>(), 
-                                             std::placeholders::_1, std::placeholders::_2), function_traits<Function>::arity };
+                                             std::placeholders::_1, std::placeholders::_2), function_traits<Function>::arity, options };
+    }
+
+    template<typename Function, typename Factory>
+    void bind_per_core_member_func(const std::string& protocol, const Function& func, const Factory& factory, 
+                                   const bind_options& options)
+    {
+        using self_t = typename std::decay<decltype(*factory())>::type;
+        auto instances = std::make_shared<per_core<self_t>>([factory]{ return std::shared_ptr<self_t>(factory()); });
+        invoker_map_[protocol] = { [func, instances](parser_util& parser, std::string& result)
+        {
+            invoker<Function>::template apply_member<std::tuple<>, self_t>(func, instances->get(), std::tuple<>(), parser, result);
+        }, function_traits<Function>::arity, options };
     }
 
     template<typename Function>
-    void bind_non_member_func_raw(const std::string& protocol, const Function& func)
+    void bind_non_member_func_raw(const std::string& protocol, const Function& func, const bind_options& options)
     {
         invoker_raw_map_[protocol] = { std::bind(&invoker_raw<Function>::apply, func, 
-                                                std::placeholders::_1, std::placeholders::_2) };
+                                                std::placeholders::_1, std::placeholders::_2), options };
     }
 
     template<typename Function, typename Self>
-    void bind_member_func_raw(const std::string& protocol, const Function& func, Self* self)
+    void bind_member_func_raw(const std::string& protocol, const Function& func, Self* self, const bind_options& options)
     {
         invoker_raw_map_[protocol] = { std::bind(&invoker_raw<Function>::template apply_member<Self>, func, self, 
-                                                std::placeholders::_1, std::placeholders::_2) };
+                                                std::placeholders::_1, std::placeholders::_2), options };
+    }
+
+    void bind_batch_func(const std::string& protocol, const invoker_function_batch::function_t& func, const bind_options& options)
+    {
+        auto invoker = std::make_shared<invoker_function_batch>(func, options);
+        batcher_map_[protocol] = std::make_shared<batcher>(options.max_batch_size, options.max_batch_delay_micro, 
+                                                           [this, invoker](batch_t&& batch){ dispatch_batch(invoker, std::move(batch)); });
     }
 
 private:
     thread_pool threadpool_;
+    bool is_thread_per_core_ = false;
     std::unordered_map<std::string, invoker_function> invoker_map_;
     std::unordered_map<std::string, invoker_function_raw> invoker_raw_map_;
+    std::unordered_map<std::string, std::shared_ptr<batcher>> batcher_map_;
+    single_flight flights_;
+    flow_key flow_key_ = flow_key::none;
+    rate_limiter limiter_;
 };
 
 }
@@ -4,7 +4,10 @@
 #include "io_service_pool.hpp"
 #include "router.hpp"
 #include "connection.hpp"
+#include "shm_listener.hpp"
 #include "base/string_util.hpp"
+#include "base/file_util.hpp"
+#include "base/thread_util.hpp"
 
 namespace easyrpc
 {
@@ -15,7 +18,7 @@ public:
     server(const server&) = delete;
     server& operator=(const server&) = delete;
     server() : ios_pool_(std::thread::hardware_concurrency()), 
-    acceptor_(ios_pool_.get_io_service()) {}
+    acceptor_(ios_pool_.get_io_service()), accept_timer_(acceptor_.get_executor()) {}
 
     ~server()
     {
@@ -24,6 +27,26 @@ public:
 
     server& listen(const std::string& address)
     {
+        if (string_util::starts_with(address, unix_prefix))
+        {
+            unix_path_ = address.substr(unix_prefix.size());
+            if (unix_path_.empty())
+            {
+                throw std::invalid_argument("Address format error");
+            }
+            return *this;
+        }
+
+        if (string_util::starts_with(address, shm_prefix))
+        {
+#ifdef EASYRPC_HAS_SHM_TRANSPORT
+            shm_name_ = shm_segment::make_name(address);
+            return *this;
+#else
+            throw std::invalid_argument("Shared memory transport is not supported");
+#endif
+        }
+
         if (string_util::contains(address, ":"))
         {
             std::vector<std::string> token = string_util::split(address, ":");
@@ -55,6 +78,8 @@ public:
     {
         ip_ = ip;
         port_ = port;
+        unix_path_.clear();
+        shm_name_.clear();
         return *this;
     }
 
@@ -70,9 +95,136 @@ public:
         return *this;
     }
 
+    // worker线程数随负载在[min_threads, max_threads]之间伸缩：请求排队超过target_queue_wait_milli
+    // 而且没有空闲线程时增加，空闲超过idle_milli时减少；handler阻塞在I/O上时max_threads可以超过30.
+    server& adaptive_workers(std::size_t min_threads, std::size_t max_threads, std::size_t target_queue_wait_milli, 
+                             std::size_t idle_milli = default_worker_idle_milli)
+    {
+        router::instance().adaptive_workers(min_threads, max_threads, target_queue_wait_milli, idle_milli);
+        return *this;
+    }
+
+    // 每个io线程绑定一个CPU，自己的连接上的请求由自己执行，不再使用worker线程池.
+    server& thread_per_core()
+    {
+        is_thread_per_core_ = true;
+        return *this;
+    }
+
+    // io线程依次绑定到这些CPU上，io线程数等于CPU个数.
+    server& io_cpus(const std::vector<std::size_t>& cpus)
+    {
+        io_cpus_ = cpus;
+        return *this;
+    }
+
+    server& worker_cpus(const std::vector<std::size_t>& cpus)
+    {
+        worker_cpus_ = cpus;
+        return *this;
+    }
+
+    // io线程和worker线程都放到指定NUMA节点上.
+    server& numa_node(std::size_t node)
+    {
+        std::vector<std::size_t> cpus = thread_util::numa_node_cpus(node);
+        if (cpus.empty())
+        {
+            throw std::invalid_argument("Invaild numa node: " + std::to_string(node));
+        }
+        io_cpus_ = cpus;
+        worker_cpus_ = cpus;
+        return *this;
+    }
+
+    // 低时延模式：io线程没有事件时先自旋spin_micro再睡眠，适合io线程独占CPU的部署；
+    // socket_busy_poll_micro不为0时在连接上设置SO_BUSY_POLL，读取时内核直接轮询网卡队列.
+    server& busy_poll(std::size_t spin_micro, std::size_t socket_busy_poll_micro = 0)
+    {
+        ios_pool_.set_busy_poll(spin_micro);
+        socket_busy_poll_micro_ = socket_busy_poll_micro;
+        return *this;
+    }
+
+    // 连接数达到max_connections后按policy处理新连接：默认暂停accept，让新连接留在内核的backlog中.
+    server& max_connections(std::size_t max_connections, admission_policy policy = admission_policy::backlog)
+    {
+        admission_.set_max_connections(max_connections, policy);
+        return *this;
+    }
+
+    // 所有连接已读入、尚未处理完的请求最多占用max_bytes内存，超过时暂停读取，单个请求大于max_bytes时断开连接.
+    server& max_buffered_memory(std::size_t max_bytes)
+    {
+        admission_.set_max_buffered_bytes(max_bytes);
+        return *this;
+    }
+
+    std::size_t connection_count() const
+    {
+        return admission_.connections();
+    }
+
+    // 任务队列长度超过max_queue_size或队首任务排队超过max_queue_wait_milli时，
+    // 按policy拒绝新请求或丢弃最早的请求，并应答overloaded，io线程不会被阻塞.
+    server& load_shedding(overload_policy policy, std::size_t max_queue_size = max_task_quque_size, 
+                          std::size_t max_queue_wait_milli = 0)
+    {
+        router::instance().load_shedding(policy, max_queue_size, max_queue_wait_milli);
+        return *this;
+    }
+
+    // 低优先级的请求每多排队aging_milli就提升一级，防止高优先级流量持续时被饿死.
+    server& priority_aging(std::size_t aging_milli)
+    {
+        router::instance().priority_aging(aging_milli);
+        return *this;
+    }
+
+    // 同一优先级的请求按连接或客户端地址轮流交给worker，大请求按body大小多占轮次.
+    server& fair_queuing(flow_key key)
+    {
+        router::instance().fair_queuing(key);
+        return *this;
+    }
+
+    // 每个flow(没有开启公平排队时为每个连接)每秒最多per_second个请求，允许burst个突发，超出的以overloaded应答.
+    server& rate_limit(double per_second, double burst)
+    {
+        router::instance().rate_limit(per_second, burst);
+        return *this;
+    }
+
     void run()
     {
-        router::instance().multithreaded(thread_num_);
+        if (is_thread_per_core_ && io_cpus_.empty())
+        {
+            io_cpus_ = thread_util::all_cpus();
+        }
+
+        if (!io_cpus_.empty())
+        {
+            ios_pool_.resize(io_cpus_.size());
+            ios_pool_.set_cpus(io_cpus_);
+        }
+
+        if (is_thread_per_core_)
+        {
+            router::instance().thread_per_core();
+        }
+        else
+        {
+            router::instance().worker_cpus(worker_cpus_);
+            router::instance().multithreaded(thread_num_);
+        }
+#ifdef EASYRPC_HAS_SHM_TRANSPORT
+        if (!shm_name_.empty())
+        {
+            shm_listener_ = std::make_unique<shm_listener>(shm_name_);
+            shm_listener_->run();
+            return;
+        }
+#endif
         listen();
         accept();
         ios_pool_.run();
@@ -80,19 +232,45 @@ public:
 
     void stop()
     {
+#ifdef EASYRPC_HAS_SHM_TRANSPORT
+        shm_listener_.reset();
+#endif
         ios_pool_.stop();
+        remove_unix_socket_file();
     }
 
+    // options.prio为客户端未指定优先级时该协议的默认优先级.
     template<typename Function>
-    void bind(const std::string& protocol, const Function& func)
+    void bind(const std::string& protocol, const Function& func, const bind_options& options = bind_options())
     {
-        router::instance().bind(protocol, func);
+        router::instance().bind(protocol, func, options);
     }
 
     template<typename Function, typename Self>
-    void bind(const std::string& protocol, const Function& func, Self* self)
+    void bind(const std::string& protocol, const Function& func, Self* self, const bind_options& options = bind_options())
+    {
+        router::instance().bind(protocol, func, self, options); 
+    }
+
+    // factory为每个核创建一个handler对象，核之间不共享状态.
+    template<typename Function, typename Factory>
+    void bind_per_core(const std::string& protocol, const Function& func, const Factory& factory, 
+                       const bind_options& options = bind_options())
+    {
+        router::instance().bind_per_core(protocol, func, factory, options);
+    }
+
+    // handler一次处理一批请求：std::vector<R>(const std::vector<T>&)，客户端按协议R(T)正常调用.
+    template<typename Function>
+    void bind_batch(const std::string& protocol, const Function& func, const bind_options& options = bind_options())
     {
-        router::instance().bind(protocol, func, self); 
+        router::instance().bind_batch(protocol, func, options);
+    }
+
+    template<typename Function, typename Self>
+    void bind_batch(const std::string& protocol, const Function& func, Self* self, const bind_options& options = bind_options())
+    {
+        router::instance().bind_batch(protocol, func, self, options);
     }
 
     void unbind(const std::string& protocol)
@@ -106,15 +284,15 @@ public:
     }
 
     template<typename Function>
-    void bind_raw(const std::string& protocol, const Function& func)
+    void bind_raw(const std::string& protocol, const Function& func, const bind_options& options = bind_options())
     {
-        router::instance().bind_raw(protocol, func);
+        router::instance().bind_raw(protocol, func, options);
     }
 
     template<typename Function, typename Self>
-    void bind_raw(const std::string& protocol, const Function& func, Self* self)
+    void bind_raw(const std::string& protocol, const Function& func, Self* self, const bind_options& options = bind_options())
     {
-        router::instance().bind_raw(protocol, func, self); 
+        router::instance().bind_raw(protocol, func, self, options); 
     }
 
     void unbind_raw(const std::string& protocol)
@@ -130,6 +308,12 @@ public:
 private:
     void listen()
     {
+        if (!unix_path_.empty())
+        {
+            listen_local();
+            return;
+        }
+
         boost::asio::ip::tcp::endpoint ep(boost::asio::ip::address_v4::from_string(ip_), port_);
         acceptor_.open(ep.protocol());
         acceptor_.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
@@ -137,27 +321,207 @@ private:
         acceptor_.listen();
     }
 
+    void listen_local()
+    {
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+        boost::asio::local::stream_protocol::endpoint ep(unix_path_);
+        remove_stale_socket_file(ep);
+        acceptor_.open(ep.protocol());
+        acceptor_.bind(ep);
+        acceptor_.listen();
+#else
+        throw std::invalid_argument("Unix domain socket is not supported");
+#endif
+    }
+
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+    // 上次异常退出可能残留socket文件，不删除的话bind会失败；只删除连不上的socket文件，
+    // 别的文件或者还有server在监听时报错.
+    void remove_stale_socket_file(const boost::asio::local::stream_protocol::endpoint& ep)
+    {
+        struct stat st;
+        if (lstat(unix_path_.c_str(), &st) != 0)
+        {
+            return;
+        }
+
+        if (!S_ISSOCK(st.st_mode))
+        {
+            throw std::runtime_error("Not a socket file: " + unix_path_);
+        }
+
+        boost::asio::local::stream_protocol::socket probe(acceptor_.get_executor());
+        boost::system::error_code ec;
+        probe.connect(ep, ec);
+        if (!ec)
+        {
+            throw std::runtime_error("Address already in use: " + unix_path_);
+        }
+        file_util::remove(unix_path_);
+    }
+#endif
+
+    void remove_unix_socket_file()
+    {
+        if (!unix_path_.empty() && acceptor_.is_open())
+        {
+            boost::system::error_code ignore_ec;
+            acceptor_.close(ignore_ec);
+            file_util::remove(unix_path_);
+        }
+    }
+
+    // 先占连接名额再accept，名额由connection析构时归还.
     void accept()
     {
+        if (!admission_.try_admit())
+        {
+            if (admission_.policy() == admission_policy::backlog)
+            {
+                accept_later();
+            }
+            else
+            {
+                reject();
+            }
+            return;
+        }
+
+        if (ios_pool_.is_pinned() && unix_path_.empty())
+        {
+            accept_on_incoming_cpu();
+            return;
+        }
+
         std::shared_ptr<connection> conn = 
-            std::make_shared<connection>(ios_pool_.get_io_service(), timeout_milli_);
+            std::make_shared<connection>(ios_pool_.get_io_service(), timeout_milli_, &admission_);
         acceptor_.async_accept(conn->socket(), [this, conn](boost::system::error_code ec)
+        {
+            if (ec)
+            {
+                accept_failed(ec);
+                return;
+            }
+            accept_backoff_.reset();
+            set_busy_poll(conn->socket(), socket_busy_poll_micro_);
+            conn->start();
+            accept();
+        });
+    }
+
+    // 文件描述符耗尽等错误立即重试只会空转，等一会儿再accept.
+    void accept_failed(const boost::system::error_code& ec)
+    {
+        if (ec == boost::asio::error::operation_aborted)
+        {
+            return;
+        }
+        log_warn("Accept failed: {}", ec.message());
+        accept_later();
+    }
+
+    void accept_later()
+    {
+        accept_timer_.expires_from_now(std::chrono::milliseconds(accept_backoff_.next_milli()));
+        accept_timer_.async_wait([this](boost::system::error_code ec)
         {
             if (!ec)
             {
+                accept();
+            }
+        });
+    }
+
+    // 超过连接数的新连接accept后立即关闭.
+    void reject()
+    {
+        auto socket = std::make_shared<boost::asio::generic::stream_protocol::socket>(acceptor_.get_executor());
+        acceptor_.async_accept(*socket, [this, socket](boost::system::error_code ec)
+        {
+            if (ec)
+            {
+                accept_failed(ec);
+                return;
+            }
+            log_warn("Too many connections, reject");
+            socket->close(ec);
+            accept();
+        });
+    }
+
+    // 先accept，再根据SO_INCOMING_CPU把连接交给处理该网卡队列的CPU(或同一NUMA节点)上的io线程.
+    void accept_on_incoming_cpu()
+    {
+        auto socket = std::make_shared<boost::asio::generic::stream_protocol::socket>(acceptor_.get_executor());
+        acceptor_.async_accept(*socket, [this, socket](boost::system::error_code ec)
+        {
+            if (ec)
+            {
+                admission_.release_connection();
+                accept_failed(ec);
+                return;
+            }
+
+            accept_backoff_.reset();
+            auto endpoint = socket->local_endpoint(ec);
+            if (ec)
+            {
+                // 连接在accept之后已经被对端重置.
+                log_warn("Get local endpoint failed: {}", ec.message());
+                admission_.release_connection();
+                socket->close(ec);
+                accept();
+                return;
+            }
+
+            auto protocol = endpoint.protocol();
+            int cpu = incoming_cpu(*socket);
+            std::shared_ptr<connection> conn = 
+                std::make_shared<connection>(ios_pool_.get_io_service(cpu), timeout_milli_, &admission_);
+            conn->socket().assign(protocol, socket->release(ec), ec);
+            if (!ec)
+            {
+                set_busy_poll(conn->socket(), socket_busy_poll_micro_);
                 conn->start();
             }
             accept();
         });
     }
 
+    int incoming_cpu(boost::asio::generic::stream_protocol::socket& socket)
+    {
+#ifdef SO_INCOMING_CPU
+        int cpu = -1;
+        socklen_t len = sizeof(cpu);
+        if (getsockopt(socket.native_handle(), SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) == -1)
+        {
+            return -1;
+        }
+        return cpu;
+#else
+        return -1;
+#endif
+    }
+
 private:
     io_service_pool ios_pool_;
-    boost::asio::ip::tcp::acceptor acceptor_;
+    boost::asio::basic_socket_acceptor<boost::asio::generic::stream_protocol> acceptor_;
     std::string ip_ = "0.0.0.0";
     unsigned short port_ = 50051;
+    std::string unix_path_;
+    std::string shm_name_;
+#ifdef EASYRPC_HAS_SHM_TRANSPORT
+    std::unique_ptr<shm_listener> shm_listener_;
+#endif
     std::size_t timeout_milli_ = 0;
     std::size_t thread_num_ = 1;
+    bool is_thread_per_core_ = false;
+    std::vector<std::size_t> io_cpus_;
+    std::vector<std::size_t> worker_cpus_;
+    std::size_t socket_busy_poll_micro_ = 0;
+    admission_control admission_;
+    boost::asio::steady_timer accept_timer_;
+    backoff accept_backoff_;
 };
 
 }
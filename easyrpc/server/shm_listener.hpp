@@ -0,0 +1,301 @@
+#ifndef _SHM_LISTENER_H
+#define _SHM_LISTENER_H
+
+#include <signal.h>
+#include <errno.h>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include "base/header.hpp"
+#include "base/shm_ring.hpp"
+#include "base/logger.hpp"
+#include "base/tracer.hpp"
+#include "inflight_requests.hpp"
+#include "router.hpp"
+
+#ifdef EASYRPC_HAS_SHM_TRANSPORT
+
+namespace easyrpc
+{
+
+// 与connection对外接口一致，交给router::route使用.
+class shm_connection
+{
+public:
+    shm_connection(const shm_connection&) = delete;
+    shm_connection& operator=(const shm_connection&) = delete;
+    shm_connection(shm_channel& ch) : channel_(ch), connection_flow_(next_connection_flow()) {}
+
+    void write(unsigned int request_id, const std::string& body, rpc_status status = rpc_status::ok, 
+               const cancel_token& token = nullptr, unsigned int trace_id = 0)
+    {
+        inflight_.remove(request_id, token);
+        unsigned int body_len = static_cast<unsigned int>(body.size());
+        if (body_len + response_header_len > shm_ring_size)
+        {
+            throw std::runtime_error("Send data is too big");
+        }
+
+        response_header head{ body_len, status, request_id };
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (is_closed_)
+        {
+            return;
+        }
+
+        // 客户端不读取应答时在这里等待，通道被回收(close)或断开后放弃.
+        while (!channel_.response.try_write({ { &head, sizeof(head) }, { body.data(), body.size() } }))
+        {
+            if (is_closed_ || channel_.state.load() != static_cast<std::uint32_t>(shm_channel_state::busy))
+            {
+                return;
+            }
+            std::this_thread::yield();
+        }
+
+        channel_.response_seq.fetch_add(1);
+        if (channel_.client_waiting.load())
+        {
+            futex_wake(channel_.response_seq);
+        }
+        if (trace_id != 0)
+        {
+            tracer::instance().record(trace_id, request_id, trace_point::write_complete);
+        }
+    }
+
+    cancel_token add_request(unsigned int request_id)
+    {
+        return inflight_.add(request_id);
+    }
+
+    void cancel_request(unsigned int request_id)
+    {
+        inflight_.cancel(request_id);
+    }
+
+    std::uint64_t flow_id(flow_key key) const
+    {
+        return key == flow_key::client_address ? process_flow(channel_.owner_pid.load()) : connection_flow_;
+    }
+
+    void disconnect()
+    {
+        inflight_.cancel_all();
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (is_closed_)
+        {
+            return;
+        }
+
+        std::uint32_t expected = static_cast<std::uint32_t>(shm_channel_state::busy);
+        if (channel_.state.compare_exchange_strong(expected, static_cast<std::uint32_t>(shm_channel_state::closed)))
+        {
+            channel_.response_seq.fetch_add(1);
+            futex_wake(channel_.response_seq);
+        }
+    }
+
+    // 先置位再加锁，正在等待应答空间的write看到后退出并释放锁；返回后不会再有应答写入通道.
+    void close()
+    {
+        inflight_.cancel_all();
+        is_closed_ = true;
+        std::lock_guard<std::mutex> lock(mutex_);
+    }
+
+private:
+    shm_channel& channel_;
+    std::uint64_t connection_flow_;
+    std::mutex mutex_;
+    std::atomic<bool> is_closed_{ false };
+    inflight_requests inflight_;
+};
+
+class shm_listener
+{
+public:
+    shm_listener(const shm_listener&) = delete;
+    shm_listener& operator=(const shm_listener&) = delete;
+    shm_listener(const std::string& name) : segment_(name, true)
+    {
+        for (std::size_t i = 0; i < shm_channel_count; ++i)
+        {
+            conn_vec_.emplace_back(std::make_shared<shm_connection>(segment_.channel(i)));
+        }
+    }
+
+    ~shm_listener()
+    {
+        stop();
+    }
+
+    void run()
+    {
+        thread_ = std::make_unique<std::thread>([this]{ poll(); });
+    }
+
+    void stop()
+    {
+        is_stop_ = true;
+        segment_.header().doorbell.fetch_add(1);
+        futex_wake(segment_.header().doorbell);
+        if (thread_ != nullptr && thread_->joinable())
+        {
+            thread_->join();
+        }
+    }
+
+private:
+    void poll()
+    {
+        std::size_t idle_count = 0;
+        auto last_check_time = std::chrono::steady_clock::now();
+        shm_segment_header& header = segment_.header();
+        while (!is_stop_)
+        {
+            std::uint32_t seq = header.doorbell.load();
+            bool busy = false;
+            for (std::size_t i = 0; i < shm_channel_count; ++i)
+            {
+                busy |= handle_channel(i);
+            }
+
+            if (busy)
+            {
+                idle_count = 0;
+                continue;
+            }
+
+            // 先自旋一段时间，仍然空闲再睡眠在futex上.
+            if (++idle_count < max_spin_count)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+
+            auto now = std::chrono::steady_clock::now();
+            if (now - last_check_time > std::chrono::seconds(1))
+            {
+                reclaim_dead_channels();
+                last_check_time = now;
+            }
+
+            header.server_waiting.store(1);
+            futex_wait(header.doorbell, seq, sleep_milli);
+            header.server_waiting.store(0);
+        }
+    }
+
+    bool handle_channel(std::size_t index)
+    {
+        shm_channel& ch = segment_.channel(index);
+        std::uint32_t state = ch.state.load();
+        if (state == static_cast<std::uint32_t>(shm_channel_state::closing))
+        {
+            reset_channel(index);
+            return false;
+        }
+
+        if (state != static_cast<std::uint32_t>(shm_channel_state::busy))
+        {
+            return false;
+        }
+
+        bool busy = false;
+        while (ch.state.load() == static_cast<std::uint32_t>(shm_channel_state::busy) 
+               && ch.request.readable() >= request_header_len)
+        {
+            read_request(index);
+            busy = true;
+        }
+        return busy;
+    }
+
+    void read_request(std::size_t index)
+    {
+        shm_channel& ch = segment_.channel(index);
+        auto& conn = conn_vec_[index];
+        request_header req_head;
+        ch.request.read(&req_head, request_header_len);
+        if (req_head.mode == call_mode::cancel)
+        {
+            conn->cancel_request(req_head.request_id);
+            return;
+        }
+
+        std::size_t len = req_head.protocol_len + req_head.body_len;
+        if (len == 0 || len > ch.request.readable())
+        {
+            log_warn("Invaild request header");
+            conn->disconnect();
+            return;
+        }
+
+        std::string protocol(req_head.protocol_len, '\0');
+        std::string body(req_head.body_len, '\0');
+        ch.request.read(&protocol[0], protocol.size());
+        ch.request.read(&body[0], body.size());
+
+        tracer& t = tracer::instance();
+        if (t.is_enabled())
+        {
+            if (req_head.trace_id == 0)
+            {
+                req_head.trace_id = t.next_trace_id();
+            }
+            // 共享内存通道上请求头和请求体一起到达.
+            t.record(req_head.trace_id, req_head.request_id, trace_point::header_read);
+            t.record(req_head.trace_id, req_head.request_id, trace_point::body_read);
+        }
+        router::instance().route(protocol, body, req_head, conn);
+    }
+
+    void reset_channel(std::size_t index)
+    {
+        // 旧的shm_connection可能还被worker线程持有，关闭后替换，防止迟到的应答写进新会话.
+        conn_vec_[index]->close();
+        conn_vec_[index] = std::make_shared<shm_connection>(segment_.channel(index));
+
+        shm_channel& ch = segment_.channel(index);
+        ch.request.reset();
+        ch.response.reset();
+        ch.owner_pid.store(0);
+        ch.state.store(static_cast<std::uint32_t>(shm_channel_state::free));
+    }
+
+    void reclaim_dead_channels()
+    {
+        for (std::size_t i = 0; i < shm_channel_count; ++i)
+        {
+            shm_channel& ch = segment_.channel(i);
+            if (ch.state.load() == static_cast<std::uint32_t>(shm_channel_state::free))
+            {
+                continue;
+            }
+
+            pid_t pid = ch.owner_pid.load();
+            if (pid > 0 && kill(pid, 0) == -1 && errno == ESRCH)
+            {
+                log_warn("Reclaim shared memory channel of dead process: {}", pid);
+                reset_channel(i);
+            }
+        }
+    }
+
+private:
+    static const std::size_t max_spin_count = 1000;
+    static const std::size_t sleep_milli = 100;
+    shm_segment segment_;
+    std::vector<std::shared_ptr<shm_connection>> conn_vec_;
+    std::unique_ptr<std::thread> thread_;
+    std::atomic<bool> is_stop_{ false };
+};
+
+}
+
+#endif
+#endif
@@ -0,0 +1,106 @@
+#ifndef _SINGLE_FLIGHT_H
+#define _SINGLE_FLIGHT_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+#include "base/header.hpp"
+#include "base/request_context.hpp"
+
+namespace easyrpc
+{
+
+// 相同key的请求正在执行时，后到的请求只登记等待，执行结果发给所有等待者.
+class single_flight
+{
+public:
+    using reply_t = std::function<void(const std::string& body, rpc_status status)>;
+
+    single_flight() = default;
+    single_flight(const single_flight&) = delete;
+    single_flight& operator=(const single_flight&) = delete;
+
+    // key上没有正在执行的请求时返回新的request_group，由调用方以它执行并在完成后调用complete，否则返回nullptr；
+    // 每个等待者都加入group，执行时的deadline取等待者中最晚的，所有等待者都取消后执行随之取消.
+    std::shared_ptr<request_group> join(const std::string& key, const request_context& ctx, const reply_t& reply)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& f = flight_map_[key];
+        bool is_first = f.waiters.empty();
+        if (is_first)
+        {
+            f.group = std::make_shared<request_group>();
+        }
+        f.group->join(ctx.deadline(), ctx.token());
+        f.waiters.emplace_back(reply);
+        return is_first ? f.group : nullptr;
+    }
+
+    // 只完成group对应的那一次执行，之后同一key上新发起的执行不受影响.
+    void complete(const std::string& key, const std::shared_ptr<request_group>& group, 
+                  const std::string& body, rpc_status status)
+    {
+        std::vector<reply_t> waiters;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto iter = flight_map_.find(key);
+            if (iter == flight_map_.end() || iter->second.group != group)
+            {
+                return;
+            }
+            waiters.swap(iter->second.waiters);
+            flight_map_.erase(iter);
+        }
+
+        for (auto& reply : waiters)
+        {
+            reply(body, status);
+        }
+    }
+
+private:
+    struct flight
+    {
+        std::shared_ptr<request_group> group;
+        std::vector<reply_t> waiters;
+    };
+
+private:
+    std::mutex mutex_;
+    std::unordered_map<std::string, flight> flight_map_;
+};
+
+// 代替连接交给invoker，应答时把结果转发给同一key上的所有等待者；
+// 等待者都已取消而没有执行或应答时，销毁时结束这次执行，之后加入的等待者收到cancelled.
+class flight_responder
+{
+public:
+    flight_responder(const flight_responder&) = delete;
+    flight_responder& operator=(const flight_responder&) = delete;
+    flight_responder(single_flight& flights, const std::string& key, const std::shared_ptr<request_group>& group) 
+        : flights_(flights), key_(key), group_(group) {}
+
+    ~flight_responder()
+    {
+        flights_.complete(key_, group_, "Cancelled", rpc_status::cancelled);
+    }
+
+    void write(unsigned int, const std::string& body, rpc_status status, const cancel_token& = nullptr, unsigned int = 0)
+    {
+        flights_.complete(key_, group_, body, status);
+    }
+
+    void disconnect() {}
+
+private:
+    single_flight& flights_;
+    std::string key_;
+    std::shared_ptr<request_group> group_;
+};
+
+}
+
+#endif
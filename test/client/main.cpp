@@ -1,11 +1,15 @@
 #include <iostream>
+#include <fstream>
 #include <thread>
+#include <sys/wait.h>
 #include <gtest/gtest.h>
 #include <easyrpc/easyrpc.hpp>
 #include "user_define_classes.hpp"
 
 EASYRPC_RPC_PROTOCOL_DEFINE(say_hello, void());
 EASYRPC_RPC_PROTOCOL_DEFINE(echo, std::string(const std::string&));
+EASYRPC_RPC_PROTOCOL_DEFINE(not_bound, void());
+EASYRPC_RPC_PROTOCOL_DEFINE(echo_batch, std::string(const std::string&));
 EASYRPC_RPC_PROTOCOL_DEFINE(query_person_info, std::vector<person_info_res>(const person_info_req&));
 
 TEST(EasyRpcTest, ClientCase)
@@ -20,6 +24,9 @@ TEST(EasyRpcTest, ClientCase)
         std::string ret = app.call(echo, "Hello world");
         EXPECT_STREQ("Hello world", ret.c_str());
 
+        ret = app.call(echo_batch, "Hello world");
+        EXPECT_STREQ("Hello world", ret.c_str());
+
         person_info_req req { 12345678, "Jack" };
         auto vec = app.call(query_person_info, req);
         EXPECT_EQ(2, static_cast<int>(vec.size()));
@@ -33,6 +40,10 @@ TEST(EasyRpcTest, ClientCase)
 
         app.call_raw<easyrpc::one_way>("say_hi", "Hi");
 
+        EXPECT_THROW(app.call(not_bound), easyrpc::not_bound_error);
+        ret = app.call(echo, "Hello world");
+        EXPECT_STREQ("Hello world", ret.c_str());
+
 #ifdef ENABLE_JSON
         person_info_req req2 { 12345678, "Jack" };
         Serializer sr;
@@ -57,6 +68,258 @@ TEST(EasyRpcTest, ClientCase)
     }
 }
 
+// server进程只监听TCP，Unix domain socket的server在本进程中单独启动.
+TEST(EasyRpcTest, LocalClientCase)
+{
+    easyrpc::server local_app;
+    easyrpc::client app;
+
+    try
+    {
+        local_app.bind("echo", [](const std::string& str){ return str; });
+        local_app.listen("unix:/tmp/easyrpc_test.sock").run();
+        app.connect("unix:/tmp/easyrpc_test.sock").run();
+
+        std::string ret = app.call(echo, "Hello world");
+        EXPECT_STREQ("Hello world", ret.c_str());
+
+        // 还有server在监听的socket文件和普通文件都不删除.
+        easyrpc::server other;
+        EXPECT_THROW(other.listen("unix:/tmp/easyrpc_test.sock").run(), std::runtime_error);
+        EXPECT_STREQ("Hello world", app.call(echo, "Hello world").c_str());
+        std::ofstream("/tmp/easyrpc_test.file") << "data";
+        easyrpc::server file_app;
+        EXPECT_THROW(file_app.listen("unix:/tmp/easyrpc_test.file").run(), std::runtime_error);
+        EXPECT_TRUE(easyrpc::file_util::is_exists("/tmp/easyrpc_test.file"));
+        easyrpc::file_util::remove("/tmp/easyrpc_test.file");
+    }
+    catch (std::exception& e)
+    {
+        easyrpc::log_warn(e.what());
+        FAIL();
+    }
+}
+
+#ifdef EASYRPC_HAS_SHM_TRANSPORT
+// 客户端进程在应答塞满共享内存环时退出，服务端回收它的通道后其他客户端继续可用.
+TEST(EasyRpcTest, ShmClientCase)
+{
+    const std::string address = "shm:/easyrpc_test_shm";
+    easyrpc::server shm_app;
+    easyrpc::client app;
+
+    try
+    {
+        shm_app.bind("echo", [](const std::string& str){ return str; });
+        shm_app.bind_raw("big", [](const std::string&){ return std::string(400 * 1024, 'x'); });
+        shm_app.listen(address).multithreaded(1).run();
+        app.connect(address).timeout(3000).run();
+        EXPECT_STREQ("Hello world", app.call(echo, "Hello world").c_str());
+        app.stop();
+
+        pid_t pid = fork();
+        ASSERT_NE(pid, -1);
+        if (pid == 0)
+        {
+            // 只发请求不读应答，第3个应答写不进环.
+            easyrpc::shm_session session(easyrpc::shm_segment::make_name(address));
+            for (unsigned int i = 1; i <= 3; ++i)
+            {
+                easyrpc::request_header head{ 3, 0, easyrpc::call_mode::raw, 0, i, easyrpc::priority::unspecified, 0, 0 };
+                session.send(head, "big", "");
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            _exit(0);
+        }
+        waitpid(pid, nullptr, 0);
+
+        easyrpc::shm_segment segment(easyrpc::shm_segment::make_name(address), false);
+        auto is_reclaimed = [&segment, pid]
+        {
+            for (std::size_t i = 0; i < easyrpc::shm_channel_count; ++i)
+            {
+                if (segment.channel(i).owner_pid.load() == pid)
+                {
+                    return false;
+                }
+            }
+            return true;
+        };
+        for (int i = 0; i < 100 && !is_reclaimed(); ++i)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+        EXPECT_TRUE(is_reclaimed());
+
+        easyrpc::client other;
+        other.connect(address).timeout(3000).run();
+        EXPECT_STREQ("Hello world", other.call(echo, "Hello world").c_str());
+    }
+    catch (std::exception& e)
+    {
+        easyrpc::log_warn(e.what());
+        FAIL();
+    }
+}
+#endif
+
+TEST(EasyRpcTest, AsyncClientCase)
+{
+    easyrpc::client app;
+
+    try
+    {
+        app.connect("localhost:50051").run();
+
+        auto future1 = app.async_call(echo, "Hello world");
+        auto future2 = app.async_call(echo, "Hello world");
+        auto future3 = app.async_call(say_hello);
+        future3.cancel();
+        EXPECT_STREQ("Hello world", future2.get().c_str());
+        EXPECT_STREQ("Hello world", future1.get().c_str());
+        try
+        {
+            // 应答可能先于取消到达.
+            future3.get();
+        }
+        catch (easyrpc::cancelled_error&)
+        {
+        }
+
+        std::string ret = app.call(echo, "Hello world");
+        EXPECT_STREQ("Hello world", ret.c_str());
+    }
+    catch (std::exception& e)
+    {
+        easyrpc::log_warn(e.what());
+        FAIL();
+    }
+}
+
+TEST(EasyRpcTest, InvalidPriorityCase)
+{
+    easyrpc::client app;
+
+    try
+    {
+        // 服务端不认识的优先级按协议的默认优先级处理.
+        app.connect("localhost:50051").priority(static_cast<easyrpc::priority>(99)).run();
+        std::string ret = app.call(echo, "Hello world");
+        EXPECT_STREQ("Hello world", ret.c_str());
+    }
+    catch (std::exception& e)
+    {
+        easyrpc::log_warn(e.what());
+        FAIL();
+    }
+}
+
+TEST(EasyRpcTest, HashRingCase)
+{
+    easyrpc::hash_ring ring;
+    ring.add("a", 0);
+    ring.add("b", 1);
+    ring.add("c", 2);
+    auto any = [](std::size_t){ return true; };
+
+    std::vector<std::size_t> before;
+    std::size_t counts[3] = { 0, 0, 0 };
+    for (int i = 0; i < 3000; ++i)
+    {
+        std::size_t index = ring.locate(std::to_string(i), any);
+        before.emplace_back(index);
+        ++counts[index];
+    }
+    for (auto count : counts)
+    {
+        EXPECT_GT(count, 500u);
+    }
+
+    // 不可用的server上的key顺延到其他server，其余key不动.
+    auto skip_b = [](std::size_t index){ return index != 1; };
+    for (int i = 0; i < 3000; ++i)
+    {
+        std::size_t index = ring.locate(std::to_string(i), skip_b);
+        EXPECT_NE(index, 1u);
+        if (before[i] != 1)
+        {
+            EXPECT_EQ(index, before[i]);
+        }
+    }
+
+    // 增加server时只有部分key换到新server上.
+    ring.add("d", 3);
+    for (int i = 0; i < 3000; ++i)
+    {
+        std::size_t index = ring.locate(std::to_string(i), any);
+        EXPECT_TRUE(index == before[i] || index == 3);
+    }
+    EXPECT_EQ(easyrpc::hash_ring::hash("key"), easyrpc::hash_ring::hash("key"));
+}
+
+TEST(EasyRpcTest, ResultCacheCase)
+{
+    easyrpc::result_cache cache;
+    std::vector<char> value;
+    std::string key1 = easyrpc::result_cache::make_key("echo", "1");
+    std::string key2 = easyrpc::result_cache::make_key("echo", "2");
+    std::string key3 = easyrpc::result_cache::make_key("echo", "3");
+    EXPECT_FALSE(cache.is_enabled("echo"));
+    cache.put("echo", key1, { 'a' }, cache.generation("echo"));
+    EXPECT_FALSE(cache.get(key1, value));
+
+    cache.enable("echo", 50);
+    cache.enable("other", 10000);
+    EXPECT_TRUE(cache.is_enabled("echo"));
+    cache.put("echo", key1, { 'a' }, cache.generation("echo"));
+    EXPECT_TRUE(cache.get(key1, value));
+    EXPECT_EQ(value, std::vector<char>({ 'a' }));
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    EXPECT_FALSE(cache.get(key1, value));
+
+    // 容量满时淘汰最久未使用的.
+    cache.enable("echo", 10000);
+    cache.set_max_entries(2);
+    cache.put("echo", key1, { '1' }, cache.generation("echo"));
+    cache.put("echo", key2, { '2' }, cache.generation("echo"));
+    EXPECT_TRUE(cache.get(key1, value));
+    cache.put("echo", key3, { '3' }, cache.generation("echo"));
+    EXPECT_EQ(cache.size(), 2u);
+    EXPECT_TRUE(cache.get(key1, value));
+    EXPECT_FALSE(cache.get(key2, value));
+    EXPECT_TRUE(cache.get(key3, value));
+
+    cache.invalidate(key1);
+    EXPECT_FALSE(cache.get(key1, value));
+    std::string other_key = easyrpc::result_cache::make_key("other", "1");
+    cache.put("other", other_key, { 'o' }, cache.generation("other"));
+    cache.put("echo", key1, { '1' }, cache.generation("echo"));
+    cache.invalidate_protocol("echo");
+    EXPECT_FALSE(cache.get(key1, value));
+    EXPECT_FALSE(cache.get(key3, value));
+    EXPECT_TRUE(cache.get(other_key, value));
+    cache.clear();
+    EXPECT_EQ(cache.size(), 0u);
+
+    // 调用期间结果失效，调用返回的旧结果不写回缓存.
+    std::uint64_t generation = cache.generation("echo");
+    cache.invalidate(key1);
+    cache.put("echo", key1, { '1' }, generation);
+    EXPECT_FALSE(cache.get(key1, value));
+    generation = cache.generation("echo");
+    cache.invalidate_protocol("echo");
+    cache.put("echo", key1, { '1' }, generation);
+    EXPECT_FALSE(cache.get(key1, value));
+    generation = cache.generation("echo");
+    cache.clear();
+    cache.put("echo", key1, { '1' }, generation);
+    EXPECT_FALSE(cache.get(key1, value));
+    generation = cache.generation("echo");
+    cache.invalidate_protocol("other");
+    cache.put("echo", key1, { '1' }, generation);
+    EXPECT_TRUE(cache.get(key1, value));
+}
+
 int main(int argc, char* argv[])
 {
     testing::InitGoogleTest(&argc, argv); 
@@ -54,11 +54,184 @@ public:
     }
 };
 
+std::vector<std::string> echo_batch(const std::vector<std::string>& strs)
+{
+    return strs;
+}
+
 void sayHi(const std::string& str)
 {
     std::cout << str << std::endl;
 }
 
+TEST(EasyRpcTest, FairQueueCase)
+{
+    easyrpc::fair_queue<int> queue;
+    queue.push_back(10, 1);
+    queue.push_back(11, 1);
+    queue.push_back(12, 1);
+    queue.push_back(20, 2);
+    queue.push_back(21, 2);
+    ASSERT_EQ(queue.oldest(), 10);
+
+    std::vector<int> order;
+    while (!queue.empty())
+    {
+        order.emplace_back(queue.front());
+        queue.pop_front();
+    }
+    ASSERT_EQ(order, std::vector<int>({ 10, 20, 11, 21, 12 }));
+
+    // cost大的flow按比例少出队.
+    queue.push_back(30, 3, 4);
+    queue.push_back(31, 3, 4);
+    queue.push_back(40, 4);
+    queue.push_back(41, 4);
+    queue.push_back(42, 4);
+    queue.push_back(43, 4);
+    queue.pop_front();
+    order.clear();
+    for (int i = 0; i < 4; ++i)
+    {
+        order.emplace_back(queue.front());
+        queue.pop_front();
+    }
+    ASSERT_EQ(order, std::vector<int>({ 40, 41, 42, 43 }));
+    ASSERT_EQ(queue.front(), 31);
+    queue.clear();
+
+    queue.push_back(50, 5);
+    queue.push_back(60, 6);
+    queue.push_back(61, 6);
+    queue.push_back(62, 6);
+    ASSERT_EQ(queue.take_from_largest(), 60);
+    ASSERT_EQ(queue.size(), 3u);
+    ASSERT_EQ(queue.front(), 50);
+    ASSERT_EQ(queue.oldest(), 50);
+}
+
+TEST(EasyRpcTest, AdmissionControlCase)
+{
+    easyrpc::admission_control admission;
+    admission.set_max_connections(2, easyrpc::admission_policy::reject);
+    ASSERT_TRUE(admission.try_admit());
+    ASSERT_TRUE(admission.try_admit());
+    ASSERT_FALSE(admission.try_admit());
+    admission.release_connection();
+    ASSERT_TRUE(admission.try_admit());
+    ASSERT_EQ(admission.connections(), 2u);
+
+    admission.set_max_buffered_bytes(100);
+    ASSERT_TRUE(admission.try_reserve(60));
+    auto reservation = easyrpc::make_reservation(admission, 60);
+    auto copy = reservation;
+    ASSERT_FALSE(admission.try_reserve(60));
+    reservation.reset();
+    ASSERT_EQ(admission.buffered_bytes(), 60u);
+    copy.reset();
+    ASSERT_EQ(admission.buffered_bytes(), 0u);
+    ASSERT_TRUE(admission.try_reserve(100));
+
+    easyrpc::backoff delay;
+    ASSERT_EQ(delay.next_milli(), easyrpc::min_accept_backoff_milli);
+    ASSERT_EQ(delay.next_milli(), easyrpc::min_accept_backoff_milli * 2);
+    for (int i = 0; i < 20; ++i)
+    {
+        delay.next_milli();
+    }
+    ASSERT_EQ(delay.next_milli(), easyrpc::max_accept_backoff_milli);
+    delay.reset();
+    ASSERT_EQ(delay.next_milli(), easyrpc::min_accept_backoff_milli);
+}
+
+TEST(EasyRpcTest, RateLimiterCase)
+{
+    easyrpc::rate_limiter limiter;
+    ASSERT_FALSE(limiter.is_enabled());
+    limiter.set(10, 3);
+    ASSERT_TRUE(limiter.is_enabled());
+    for (int i = 0; i < 3; ++i)
+    {
+        ASSERT_TRUE(limiter.allow(1));
+    }
+    ASSERT_FALSE(limiter.allow(1));
+    // 每个flow单独计数.
+    ASSERT_TRUE(limiter.allow(2));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    ASSERT_TRUE(limiter.allow(1));
+    limiter.set(0, 0);
+    ASSERT_FALSE(limiter.is_enabled());
+}
+
+TEST(EasyRpcTest, InflightRequestsCase)
+{
+    easyrpc::inflight_requests inflight;
+    auto first = inflight.add(1);
+    auto second = inflight.add(1);
+    auto other = inflight.add(2);
+    inflight.remove(1, first);
+    inflight.cancel(1);
+    ASSERT_FALSE(first->load());
+    ASSERT_TRUE(second->load());
+    ASSERT_FALSE(other->load());
+    inflight.cancel_all();
+    ASSERT_TRUE(other->load());
+}
+
+TEST(EasyRpcTest, SingleFlightCase)
+{
+    easyrpc::single_flight flights;
+    easyrpc::request_context first(1, 100, easyrpc::make_cancel_token());
+    easyrpc::request_context second(2, 5000, easyrpc::make_cancel_token());
+    int replies = 0;
+    auto reply = [&replies](const std::string& body, easyrpc::rpc_status){ replies += body == "ok" ? 1 : 0; };
+    auto group = flights.join("key", first, reply);
+    ASSERT_NE(group, nullptr);
+    ASSERT_EQ(flights.join("key", second, reply), nullptr);
+
+    easyrpc::request_context flight_ctx(1, group);
+    ASSERT_EQ(flight_ctx.deadline(), second.deadline());
+    first.token()->store(true);
+    ASSERT_FALSE(flight_ctx.is_cancelled());
+    second.token()->store(true);
+    ASSERT_TRUE(flight_ctx.is_cancelled());
+
+    flights.complete("key", group, "ok", easyrpc::rpc_status::ok);
+    ASSERT_EQ(replies, 2);
+    ASSERT_NE(flights.join("key", first, reply), nullptr);
+}
+
+#ifdef EASYRPC_HAS_SHM_TRANSPORT
+TEST(EasyRpcTest, ShmSegmentCase)
+{
+    const std::string name = "/easyrpc_test_segment";
+    // 崩溃遗留的段重新创建.
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT, 0600);
+    ASSERT_NE(fd, -1);
+    ASSERT_EQ(ftruncate(fd, 4096), 0);
+    close(fd);
+
+    easyrpc::shm_segment owner(name, true);
+    easyrpc::shm_segment peer(name, false);
+    ASSERT_EQ(peer.header().magic.load(), easyrpc::shm_magic);
+    ASSERT_THROW(easyrpc::shm_segment(name, true), std::runtime_error);
+
+    easyrpc::shm_ring& ring = owner.channel(0).request;
+    ASSERT_TRUE(ring.try_write({ { "hello", 5 }, { "world", 5 } }));
+    ASSERT_EQ(peer.channel(0).request.readable(), 10u);
+    char buf[10];
+    peer.channel(0).request.read(buf, sizeof(buf));
+    ASSERT_EQ(std::string(buf, sizeof(buf)), "helloworld");
+    ASSERT_EQ(ring.readable(), 0u);
+
+    std::string big(easyrpc::shm_ring_size, 'x');
+    ASSERT_FALSE(ring.try_write({ { big.data(), big.size() + 1 } }));
+    ASSERT_TRUE(ring.try_write({ { big.data(), big.size() } }));
+    ASSERT_FALSE(ring.try_write({ { "x", 1 } }));
+}
+#endif
+
 TEST(EasyRpcTest, ServerCase)
 {
     message_handle hander;
@@ -77,6 +250,10 @@ TEST(EasyRpcTest, ServerCase)
         ok = app.is_bind("query_person_info");
         ASSERT_TRUE(ok);
 
+        app.bind_batch("echo_batch", &echo_batch);
+        ok = app.is_bind("echo_batch");
+        ASSERT_TRUE(ok);
+
         app.bind_raw("say_hi", &sayHi);
         ok = app.is_bind_raw("say_hi");
         ASSERT_TRUE(ok);